@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Debug-info I/O benchmark for the wrapper's split DWARF mode.
+//
+// Generates a set of translation units heavy in debug info, then builds them
+// twice with the compiler directly:
+//   plain  -O2 -g
+//   split  -O2 -g -gsplit-dwarf -gz=<zlib|zstd>, linked with -gz as well
+// For each variant it prints one JSON object with the compile time, the size
+// of the objects and .dwo files the link doesn't read, the output size, and
+// the link time (median and minimum over -r links).
+
+#define DEFAULT_UNITS 200
+#define DEFAULT_FUNCTIONS 40
+#define DEFAULT_LINKS 5
+
+extern char **environ;
+
+struct variant {
+    const char *name;
+    int split;
+};
+
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Each function gets its own struct type and locals, so most of an object is
+// DWARF rather than code.
+int write_unit(const char *dir, int unit, int functions) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/tu%04d.c", dir, unit);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "#include <string.h>\n\n");
+    for (int f = 0; f < functions; f++) {
+        fprintf(file,
+                "struct tu%d_s%d {\n"
+                "    int id;\n"
+                "    long counts[8];\n"
+                "    double weights[4];\n"
+                "    const char *name;\n"
+                "    struct tu%d_s%d *next;\n"
+                "    union { unsigned flags; float ratio; } u;\n"
+                "};\n\n"
+                "long tu%d_f%d(struct tu%d_s%d *item, int n) {\n"
+                "    long total = 0;\n"
+                "    char buf[32];\n"
+                "    for (int i = 0; i < n && item; i++, item = item->next) {\n"
+                "        int slot = (item->id + i) & 7;\n"
+                "        double w = item->weights[slot & 3];\n"
+                "        total += item->counts[slot] * (long)w;\n"
+                "        memcpy(buf, item->name, sizeof(buf) - 1);\n"
+                "        total += buf[slot];\n"
+                "    }\n"
+                "    return total;\n"
+                "}\n\n",
+                unit, f, unit, f, unit, f, unit, f);
+    }
+    return fclose(file);
+}
+
+int write_main(const char *dir, int units) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/main.c", dir);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    for (int unit = 0; unit < units; unit++) {
+        fprintf(file, "struct tu%d_s0;\nlong tu%d_f0(struct tu%d_s0 *item, int n);\n", unit, unit, unit);
+    }
+    fprintf(file, "\nint main(int argc, char *argv[]) {\n    long total = 0;\n    (void)argv;\n");
+    for (int unit = 0; unit < units; unit++) {
+        fprintf(file, "    total += tu%d_f0(0, argc);\n", unit);
+    }
+    fprintf(file, "    return total != 0;\n}\n");
+    return fclose(file);
+}
+
+pid_t spawn(char *argv[]) {
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        return -1;
+    }
+    return pid;
+}
+
+int wait_child(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// Compiles main.c and every unit with up to jobs compilers at a time.
+int compile_all(const char *dir, const char *compiler, char *flags[], int units, int jobs) {
+    char source[PATH_MAX];
+    char object[PATH_MAX];
+    char *argv[16];
+    int next = -1;
+    int running = 0;
+    int failed = 0;
+
+    while (next < units || running) {
+        if (next < units && running < jobs) {
+            int argc = 0;
+            if (next < 0) {
+                snprintf(source, sizeof(source), "%s/main.c", dir);
+                snprintf(object, sizeof(object), "%s/main.o", dir);
+            } else {
+                snprintf(source, sizeof(source), "%s/tu%04d.c", dir, next);
+                snprintf(object, sizeof(object), "%s/tu%04d.o", dir, next);
+            }
+            argv[argc++] = (char *)compiler;
+            for (int i = 0; flags[i]; i++) {
+                argv[argc++] = flags[i];
+            }
+            argv[argc++] = "-c";
+            argv[argc++] = source;
+            argv[argc++] = "-o";
+            argv[argc++] = object;
+            argv[argc] = NULL;
+            if (spawn(argv) < 0) {
+                failed = 1;
+            } else {
+                running++;
+            }
+            next++;
+            continue;
+        }
+        int status;
+        if (wait(&status) < 0) {
+            break;
+        }
+        running--;
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    return failed ? -1 : 0;
+}
+
+long long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+int run_variant(const char *dir, const char *compiler, const struct variant *variant, const char *gz,
+                const char *linker, int gdb_index, int units, int jobs, int links) {
+    char path[PATH_MAX];
+    char output[PATH_MAX];
+    char fuse_ld[64];
+    char *flags[8];
+    int nflags = 0;
+
+    flags[nflags++] = "-O2";
+    flags[nflags++] = "-g";
+    if (variant->split) {
+        flags[nflags++] = "-gsplit-dwarf";
+        flags[nflags++] = (char *)gz;
+    }
+    flags[nflags] = NULL;
+
+    unsigned long long start = now_ns();
+    if (compile_all(dir, compiler, flags, units, jobs) != 0) {
+        fprintf(stderr, "%s: compile failed\n", variant->name);
+        return -1;
+    }
+    unsigned long long compile_ns = now_ns() - start;
+
+    long long object_bytes = 0;
+    long long dwo_bytes = 0;
+    for (int unit = -1; unit < units; unit++) {
+        if (unit < 0) {
+            snprintf(path, sizeof(path), "%s/main", dir);
+        } else {
+            snprintf(path, sizeof(path), "%s/tu%04d", dir, unit);
+        }
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, ".o");
+        object_bytes += file_size(path);
+        snprintf(path + len, sizeof(path) - len, ".dwo");
+        dwo_bytes += file_size(path);
+        if (!variant->split) {
+            unlink(path);
+        }
+    }
+
+    char **argv = malloc((units + 16) * sizeof(char *));
+    char **objects = malloc((units + 1) * sizeof(char *));
+    unsigned long long *times = malloc(links * sizeof(*times));
+    if (!argv || !objects || !times) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    int argc = 0;
+    argv[argc++] = (char *)compiler;
+    if (linker) {
+        snprintf(fuse_ld, sizeof(fuse_ld), "-fuse-ld=%s", linker);
+        argv[argc++] = fuse_ld;
+    }
+    if (variant->split) {
+        argv[argc++] = (char *)gz;
+        if (gdb_index) {
+            argv[argc++] = "-Wl,--gdb-index";
+        }
+    }
+    for (int unit = -1; unit < units; unit++) {
+        char *object = malloc(PATH_MAX);
+        if (!object) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        if (unit < 0) {
+            snprintf(object, PATH_MAX, "%s/main.o", dir);
+        } else {
+            snprintf(object, PATH_MAX, "%s/tu%04d.o", dir, unit);
+        }
+        objects[unit + 1] = object;
+        argv[argc++] = object;
+    }
+    snprintf(output, sizeof(output), "%s/prog", dir);
+    argv[argc++] = "-o";
+    argv[argc++] = output;
+    argv[argc] = NULL;
+
+    int status = 0;
+    for (int i = 0; i < links; i++) {
+        start = now_ns();
+        pid_t pid = spawn(argv);
+        if (pid < 0 || wait_child(pid) != 0) {
+            fprintf(stderr, "%s: link failed\n", variant->name);
+            status = -1;
+            break;
+        }
+        times[i] = now_ns() - start;
+    }
+    if (status == 0) {
+        qsort(times, links, sizeof(*times), compare_u64);
+        printf("{\"variant\":\"%s\",\"units\":%d,\"compiler\":\"%s\",\"linker\":\"%s\",\"gz\":\"%s\","
+               "\"compile_ms\":%.1f,\"object_bytes\":%lld,\"dwo_bytes\":%lld,\"output_bytes\":%lld,"
+               "\"links\":%d,\"link_ms_median\":%.1f,\"link_ms_min\":%.1f}\n",
+               variant->name, units, compiler, linker ? linker : "default", variant->split ? gz + 4 : "none",
+               compile_ns / 1e6, object_bytes, dwo_bytes, file_size(output),
+               links, times[links / 2] / 1e6, times[0] / 1e6);
+        fflush(stdout);
+    }
+    for (int unit = -1; unit < units; unit++) {
+        unlink(objects[unit + 1]);
+        free(objects[unit + 1]);
+    }
+    unlink(output);
+    free(argv);
+    free(objects);
+    free(times);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    const char *compiler = "cc";
+    const char *linker = NULL;
+    const char *gz = "-gz=zlib";
+    int units = DEFAULT_UNITS;
+    int functions = DEFAULT_FUNCTIONS;
+    int links = DEFAULT_LINKS;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int gdb_index = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:r:j:c:l:zi")) != -1) {
+        switch (opt) {
+        case 'n':
+            units = atoi(optarg);
+            break;
+        case 'f':
+            functions = atoi(optarg);
+            break;
+        case 'r':
+            links = atoi(optarg);
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'c':
+            compiler = optarg;
+            break;
+        case 'l':
+            linker = optarg;
+            break;
+        case 'z':
+            gz = "-gz=zstd";
+            break;
+        case 'i':
+            gdb_index = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n units] [-f functions] [-r links] [-j jobs] [-c compiler] [-l linker] [-z] [-i]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (units <= 0) {
+        units = DEFAULT_UNITS;
+    }
+    if (functions <= 0) {
+        functions = DEFAULT_FUNCTIONS;
+    }
+    if (links <= 0) {
+        links = DEFAULT_LINKS;
+    }
+    if (jobs <= 0) {
+        jobs = 1;
+    }
+
+    char dir[] = "/tmp/debugbench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    int status = 0;
+    if (write_main(dir, units) != 0) {
+        status = -1;
+    }
+    for (int unit = 0; unit < units && status == 0; unit++) {
+        status = write_unit(dir, unit, functions);
+    }
+    if (status != 0) {
+        perror("sources");
+    }
+
+    const struct variant variants[] = {{"plain", 0}, {"split", 1}};
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]) && status == 0; v++) {
+        status = run_variant(dir, compiler, &variants[v], gz, linker, gdb_index, units, jobs, links);
+    }
+
+    char path[PATH_MAX];
+    for (int unit = -1; unit < units; unit++) {
+        if (unit < 0) {
+            snprintf(path, sizeof(path), "%s/main", dir);
+        } else {
+            snprintf(path, sizeof(path), "%s/tu%04d", dir, unit);
+        }
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, ".c");
+        unlink(path);
+        snprintf(path + len, sizeof(path) - len, ".dwo");
+        unlink(path);
+    }
+    rmdir(dir);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
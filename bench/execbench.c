@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Exec-overhead benchmark for the module and the wrapper.
+//
+// Scenarios:
+//   nonmatch  exec /bin/true, which no rule matches
+//   match     exec a stand-in named bench-cc, which the "tool cc" rule matches
+//   tree      exec a stand-in named bench-gcc that runs cc1, as and ld
+//             stand-ins one after another, like a compiler driver
+// Each scenario runs with fork+execve and posix_spawn, for every worker
+// count given with -j. One JSON object per run is printed on stdout.
+//
+// With -w, execs that the module would intercept run the wrapper the way the
+// module redirects to it. This measures the wrapper's overhead alone, with
+// the module unloaded.
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_WORKERS "1"
+#define MODULE_SYSFS_PATH "/sys/module/interceptor_km"
+
+extern char **environ;
+
+enum method {
+    METHOD_FORK_EXEC,
+    METHOD_POSIX_SPAWN,
+    METHOD_COUNT,
+};
+
+const char *const method_names[METHOD_COUNT] = {"fork-exec", "posix-spawn"};
+
+struct scenario {
+    const char *name;
+    int intercepted;
+    char path[PATH_MAX];
+};
+
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+char *get_basename(const char *path, const char delimiter) {
+    char *last_char = strrchr(path, delimiter);
+    if (last_char) {
+        return last_char + 1;
+    }
+    return (char *)path;
+}
+
+// Runs path (through wrapper_path if set) and returns its exit status, or -1.
+int run(enum method method, const char *path, char *wrapper_path) {
+    // The module hands the wrapper the original filename in front of argv.
+    char *child_argv[] = {(char *)path, (char *)path, "-c", "bench.c", NULL};
+    char **exec_argv = wrapper_path ? child_argv : child_argv + 1;
+    const char *exec_path = wrapper_path ? wrapper_path : path;
+    pid_t pid;
+    int status;
+
+    if (method == METHOD_POSIX_SPAWN) {
+        if (posix_spawn(&pid, exec_path, NULL, NULL, exec_argv, environ) != 0) {
+            return -1;
+        }
+    } else {
+        pid = fork();
+        if (pid < 0) {
+            return -1;
+        }
+        if (pid == 0) {
+            execve(exec_path, exec_argv, environ);
+            _exit(127);
+        }
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// Stand-in for the compiler driver of the tree scenario.
+int driver_main(const char *self) {
+    const char *const tools[] = {"cc1", "as", "ld", NULL};
+    char path[PATH_MAX];
+    int dirname_len = get_basename(self, '/') - self;
+
+    for (int i = 0; tools[i]; i++) {
+        snprintf(path, sizeof(path), "%.*s%s", dirname_len, self, tools[i]);
+        if (run(METHOD_FORK_EXEC, path, NULL) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    return 0;
+}
+
+int create_standins(char *dir) {
+    const char *const names[] = {"bench-cc", "bench-gcc", "cc1", "as", "ld", NULL};
+    char self[PATH_MAX];
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+
+    if (len < 0 || !mkdtemp(dir)) {
+        return -1;
+    }
+    self[len] = '\0';
+    for (int i = 0; names[i]; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (symlink(self, path) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void remove_standins(const char *dir) {
+    const char *const names[] = {"bench-cc", "bench-gcc", "cc1", "as", "ld", NULL};
+    char path[PATH_MAX];
+    for (int i = 0; names[i]; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+const char *detect_config(const char *wrapper_path) {
+    struct stat st;
+    if (wrapper_path) {
+        return "wrapper";
+    }
+    if (stat(MODULE_SYSFS_PATH, &st) == 0) {
+        return "module";
+    }
+    return "none";
+}
+
+// Each worker stores its latencies in its own slice of a shared mapping.
+int bench(const char *config, const struct scenario *scenario, enum method method, int workers, int iterations, char *wrapper_path) {
+    size_t total = (size_t)workers * iterations;
+    unsigned long long *samples = mmap(NULL, total * sizeof(*samples), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int failed = 0;
+
+    if (samples == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    unsigned long long start = now_ns();
+    for (int w = 0; w < workers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return -1;
+        }
+        if (pid == 0) {
+            unsigned long long *slice = samples + (size_t)w * iterations;
+            for (int i = 0; i < iterations; i++) {
+                unsigned long long t0 = now_ns();
+                if (run(method, scenario->path, scenario->intercepted ? wrapper_path : NULL) != 0) {
+                    _exit(EXIT_FAILURE);
+                }
+                slice[i] = now_ns() - t0;
+            }
+            _exit(0);
+        }
+    }
+    for (int w = 0; w < workers; w++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
+    }
+    unsigned long long elapsed = now_ns() - start;
+
+    if (failed) {
+        fprintf(stderr, "%s/%s: exec failed\n", scenario->name, method_names[method]);
+    } else {
+        unsigned long long sum = 0;
+        qsort(samples, total, sizeof(*samples), compare_u64);
+        for (size_t i = 0; i < total; i++) {
+            sum += samples[i];
+        }
+        printf("{\"config\":\"%s\",\"scenario\":\"%s\",\"method\":\"%s\",\"workers\":%d,\"iterations\":%zu,"
+               "\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"ops_per_sec\":%.1f}\n",
+               config, scenario->name, method_names[method], workers, total,
+               sum / total, samples[total / 2], samples[total * 90 / 100], samples[total * 99 / 100],
+               total * 1e9 / elapsed);
+        fflush(stdout);
+    }
+    munmap(samples, total * sizeof(*samples));
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *self = get_basename(argv[0], '/');
+    if (strcmp(self, "bench-gcc") == 0) {
+        return driver_main(argv[0]);
+    }
+    if (strcmp(self, "bench-cc") == 0 || strcmp(self, "cc1") == 0 ||
+        strcmp(self, "as") == 0 || strcmp(self, "ld") == 0) {
+        return 0;
+    }
+
+    int iterations = DEFAULT_ITERATIONS;
+    char *worker_list = DEFAULT_WORKERS;
+    const char *only_scenario = NULL;
+    const char *config = NULL;
+    char *wrapper_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:j:s:c:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'j':
+            worker_list = optarg;
+            break;
+        case 's':
+            only_scenario = optarg;
+            break;
+        case 'c':
+            config = optarg;
+            break;
+        case 'w':
+            wrapper_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-j workers,...] [-s scenario] [-c config] [-w wrapper]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iterations <= 0) {
+        iterations = DEFAULT_ITERATIONS;
+    }
+    if (!config) {
+        config = detect_config(wrapper_path);
+    }
+
+    char dir[] = "/tmp/execbench.XXXXXX";
+    if (create_standins(dir) != 0) {
+        perror("stand-ins");
+        return EXIT_FAILURE;
+    }
+    struct scenario scenarios[] = {{"nonmatch", 0, "/bin/true"}, {"match", 1, ""}, {"tree", 1, ""}};
+    snprintf(scenarios[1].path, sizeof(scenarios[1].path), "%s/bench-cc", dir);
+    snprintf(scenarios[2].path, sizeof(scenarios[2].path), "%s/bench-gcc", dir);
+
+    int status = 0;
+    for (char *workers = strtok(worker_list, ","); workers; workers = strtok(NULL, ",")) {
+        for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+            if (only_scenario && strcmp(only_scenario, scenarios[s].name) != 0) {
+                continue;
+            }
+            for (int m = 0; m < METHOD_COUNT; m++) {
+                if (bench(config, &scenarios[s], m, atoi(workers) > 0 ? atoi(workers) : 1, iterations, wrapper_path) != 0) {
+                    status = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    remove_standins(dir);
+    return status;
+}
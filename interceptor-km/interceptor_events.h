@@ -0,0 +1,54 @@
+#ifndef INTERCEPTOR_EVENTS_H
+#define INTERCEPTOR_EVENTS_H
+
+#include <linux/types.h>
+
+// Layout of the mmap-able exec event area exported by the module.
+//
+// The area starts with an interceptor_events_header. One ring per possible CPU
+// follows at ring_offset + cpu * ring_stride. Each ring is an
+// interceptor_event_ring followed by nr_events slots of event_size bytes.
+// The kernel is the only writer of head and the consumer the only writer of
+// tail; slot (n & (nr_events - 1)) is valid for tail <= n < head.
+
+#define INTERCEPTOR_EVENTS_DEVICE "/dev/interceptor-events"
+#define INTERCEPTOR_EVENTS_MAGIC 0x49455654
+#define INTERCEPTOR_EVENTS_VERSION 1
+
+#define INTERCEPTOR_EVENT_COMM_LEN 16
+#define INTERCEPTOR_EVENT_RULE_LEN 80
+#define INTERCEPTOR_EVENT_NAME_LEN 256
+
+#define INTERCEPTOR_EVENT_WRAPPED (1U << 0)
+#define INTERCEPTOR_EVENT_REWRITTEN (1U << 1)
+
+struct interceptor_events_header {
+    __u32 magic;
+    __u32 version;
+    __u32 nr_cpus;
+    __u32 nr_events;
+    __u32 event_size;
+    __u32 ring_offset;
+    __u64 ring_stride;
+};
+
+struct interceptor_event_ring {
+    __u64 head;
+    __u64 dropped;
+    __u8 pad0[48];
+    __u64 tail;
+    __u8 pad1[56];
+};
+
+struct interceptor_event {
+    __u64 timestamp_ns;
+    __s32 pid;
+    __s32 ppid;
+    __u32 flags;
+    __u32 reserved;
+    char comm[INTERCEPTOR_EVENT_COMM_LEN];
+    char rule[INTERCEPTOR_EVENT_RULE_LEN];
+    char filename[INTERCEPTOR_EVENT_NAME_LEN];
+};
+
+#endif
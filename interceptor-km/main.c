@@ -7,9 +7,28 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Function Hooks
 #include <linux/binfmts.h>
+#include <linux/bitmap.h>
+#include <linux/cgroup.h>
 #include <linux/compat.h>
+#include <linux/debugfs.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/namei.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/user_namespace.h>
+#include <linux/vmalloc.h>
+
+#include "interceptor_events.h"
 
 struct user_arg_ptr {
 #ifdef CONFIG_COMPAT
@@ -23,15 +42,17 @@ struct user_arg_ptr {
     } ptr;
 };
 
-static int do_execve(struct filename *, const char __user *const __user *, const char __user *const __user *);
-static int do_execveat_common(int, struct filename *, struct user_arg_ptr, struct user_arg_ptr, int);
+struct interceptor_target;
+
+static int do_execve(struct filename *, const char __user *const __user *, const char __user *const __user *, struct interceptor_target *);
+static int do_execveat_common(int, struct filename *, struct user_arg_ptr, struct user_arg_ptr, int, struct interceptor_target *);
 static const char __user *get_user_arg_ptr(struct user_arg_ptr, int);
 static bool valid_arg_len(struct linux_binprm *, long);
 static void put_arg_page(struct page *);
 static void flush_arg_page(struct linux_binprm *, unsigned long, struct page *);
 static int count(struct user_arg_ptr, int);
 static int bprm_stack_limits(struct linux_binprm *);
-static int copy_strings(int, struct user_arg_ptr, struct linux_binprm *);
+static int copy_strings(int, struct user_arg_ptr, struct linux_binprm *, const unsigned long *);
 
 KHOOK_EXT(struct linux_binprm *, alloc_bprm, int, struct filename *);
 static struct linux_binprm *khook_alloc_bprm(int fd, struct filename *filename) {
@@ -84,10 +105,10 @@ static bool khook_is_rlimit_overlimit(struct ucounts *ucounts, enum rlimit_type
 ////////////////////////////////////////////////////////////////////////////////
 // Linux v6.1.0
 
-static int do_execve(struct filename *filename, const char __user *const __user *__argv, const char __user *const __user *__envp) {
+static int do_execve(struct filename *filename, const char __user *const __user *__argv, const char __user *const __user *__envp, struct interceptor_target *target) {
     struct user_arg_ptr argv = {.ptr.native = __argv};
     struct user_arg_ptr envp = {.ptr.native = __envp};
-    return do_execveat_common(AT_FDCWD, filename, argv, envp, 0);
+    return do_execveat_common(AT_FDCWD, filename, argv, envp, 0, target);
 }
 
 static bool valid_arg_len(struct linux_binprm *bprm, long len) {
@@ -158,7 +179,8 @@ static int bprm_stack_limits(struct linux_binprm *bprm) {
     return 0;
 }
 
-static int copy_strings(int argc, struct user_arg_ptr argv, struct linux_binprm *bprm) {
+// Arguments whose index is set in skip (if any) are left out.
+static int copy_strings(int argc, struct user_arg_ptr argv, struct linux_binprm *bprm, const unsigned long *skip) {
     struct page *kmapped_page = NULL;
     char *kaddr = NULL;
     unsigned long kpos = 0;
@@ -167,6 +189,9 @@ static int copy_strings(int argc, struct user_arg_ptr argv, struct linux_binprm
         const char __user *str;
         int len;
         unsigned long pos;
+        if (skip && test_bit(argc, skip)) {
+            continue;
+        }
         ret = -EFAULT;
         str = get_user_arg_ptr(argv, argc);
         if (IS_ERR(str)) {
@@ -244,80 +269,1138 @@ out:
 ////////////////////////////////////////////////////////////////////////////////
 
 #define MAX_NEW_ARGV 32
+#define INTERCEPTOR_NAME_MAX 256
 #define INTERCEPTOR_WRAPPER_PATH "/usr/bin/interceptor"
 
-char *const gcc_compiler_list[] = {"gcc", "g++", "c++", "cc", "xgcc", "xg++", NULL};
-char *const binutils_list[] = {"ar", "nm", "ranlib", NULL};
-char *const binutils_new_list[] = {"nm-new", NULL};
+static char *get_basename(const char *path, const char delimiter) {
+    char *last_char = strrchr(path, delimiter);
+    if (last_char != NULL) {
+        return last_char + 1;
+    }
+    return (char *)path;
+}
+
+// Bit in task_struct::atomic_flags above the kernel's PFA_* bits. It is
+// copied on fork and kept across exec, so once an intercepted exec succeeds
+// the wrapper, the real compiler and everything they spawn skip in O(1).
+#define PFA_INTERCEPTED (BITS_PER_LONG - 1)
+
+static bool interceptor_bypass(void) {
+    return test_bit(PFA_INTERCEPTED, &current->atomic_flags);
+}
+
+static void interceptor_mark(void) {
+    set_bit(PFA_INTERCEPTED, &current->atomic_flags);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Wrapper State
+
+#define WRAPPER_RETRY_INTERVAL HZ
+
+struct interceptor_wrapper {
+    refcount_t ref;
+    struct path path;
+    unsigned long ino;
+    struct rcu_head rcu;
+    char name[];
+};
+
+static char wrapper_path[PATH_MAX] = INTERCEPTOR_WRAPPER_PATH;
+static struct interceptor_wrapper __rcu *cached_wrapper;
+static unsigned long wrapper_retry;
+static DEFINE_MUTEX(wrapper_mutex);
+
+static struct interceptor_wrapper *wrapper_resolve(const char *name) {
+    struct interceptor_wrapper *wrapper;
+    size_t len = strlen(name);
+    int err;
+
+    if (name[0] != '/') {
+        return ERR_PTR(-EINVAL);
+    }
+    wrapper = kzalloc(sizeof(*wrapper) + len + 1, GFP_KERNEL);
+    if (!wrapper) {
+        return ERR_PTR(-ENOMEM);
+    }
+    err = kern_path(name, LOOKUP_FOLLOW, &wrapper->path);
+    if (err) {
+        kfree(wrapper);
+        return ERR_PTR(err);
+    }
+    if (!d_is_reg(wrapper->path.dentry)) {
+        path_put(&wrapper->path);
+        kfree(wrapper);
+        return ERR_PTR(-EACCES);
+    }
+    refcount_set(&wrapper->ref, 1);
+    wrapper->ino = d_backing_inode(wrapper->path.dentry)->i_ino;
+    memcpy(wrapper->name, name, len + 1);
+    return wrapper;
+}
+
+static void wrapper_put(struct interceptor_wrapper *wrapper) {
+    if (wrapper && refcount_dec_and_test(&wrapper->ref)) {
+        path_put(&wrapper->path);
+        kfree_rcu(wrapper, rcu);
+    }
+}
+
+static struct interceptor_wrapper *wrapper_get(void) {
+    struct interceptor_wrapper *wrapper;
+    rcu_read_lock();
+    wrapper = rcu_dereference(cached_wrapper);
+    if (wrapper && !refcount_inc_not_zero(&wrapper->ref)) {
+        wrapper = NULL;
+    }
+    rcu_read_unlock();
+    return wrapper;
+}
+
+// Caller must hold wrapper_mutex
+static int wrapper_reload_locked(void) {
+    struct interceptor_wrapper *wrapper = wrapper_resolve(wrapper_path);
+    struct interceptor_wrapper *old;
+    int err = 0;
+
+    WRITE_ONCE(wrapper_retry, jiffies + WRAPPER_RETRY_INTERVAL);
+    if (IS_ERR(wrapper)) {
+        err = PTR_ERR(wrapper);
+        wrapper = NULL;
+    }
+    old = rcu_replace_pointer(cached_wrapper, wrapper, lockdep_is_held(&wrapper_mutex));
+    wrapper_put(old);
+    return err;
+}
+
+// Returns a referenced wrapper, or NULL if it is missing. The cached state is
+// revalidated with a dentry check only; a path walk happens at most once per
+// WRAPPER_RETRY_INTERVAL while the wrapper is missing or has been replaced.
+static struct interceptor_wrapper *wrapper_acquire(void) {
+    struct interceptor_wrapper *wrapper = wrapper_get();
+    if (wrapper && !d_unlinked(wrapper->path.dentry)) {
+        return wrapper;
+    }
+    wrapper_put(wrapper);
+    if (time_before(jiffies, READ_ONCE(wrapper_retry)) || !mutex_trylock(&wrapper_mutex)) {
+        return NULL;
+    }
+    wrapper_reload_locked();
+    mutex_unlock(&wrapper_mutex);
+    return wrapper_get();
+}
+
+static int wrapper_path_set(const char *val, const struct kernel_param *kp) {
+    char *buf = kstrdup(val, GFP_KERNEL);
+    char *path;
+    int err = 0;
+
+    if (!buf) {
+        return -ENOMEM;
+    }
+    path = strim(buf);
+    if (path[0] != '/') {
+        err = -EINVAL;
+    } else if (strlen(path) >= sizeof(wrapper_path)) {
+        err = -ENAMETOOLONG;
+    }
+    if (!err) {
+        mutex_lock(&wrapper_mutex);
+        strscpy(wrapper_path, path, sizeof(wrapper_path));
+        if (wrapper_reload_locked()) {
+            pr_info("wrapper %s unavailable\n", path);
+        }
+        mutex_unlock(&wrapper_mutex);
+    }
+    kfree(buf);
+    return err;
+}
+
+static int wrapper_path_get(char *buffer, const struct kernel_param *kp) {
+    struct interceptor_wrapper *wrapper = wrapper_get();
+    int len;
+
+    mutex_lock(&wrapper_mutex);
+    if (wrapper) {
+        len = scnprintf(buffer, PAGE_SIZE, "%s %lu\n", wrapper_path, wrapper->ino);
+    } else {
+        len = scnprintf(buffer, PAGE_SIZE, "%s -\n", wrapper_path);
+    }
+    mutex_unlock(&wrapper_mutex);
+    wrapper_put(wrapper);
+    return len;
+}
+
+static const struct kernel_param_ops wrapper_path_ops = {
+    .set = wrapper_path_set,
+    .get = wrapper_path_get,
+};
+module_param_cb(wrapper_path, &wrapper_path_ops, NULL, 0644);
+MODULE_PARM_DESC(wrapper_path, "Absolute path of the userspace wrapper");
+
+////////////////////////////////////////////////////////////////////////////////
+// Match Rules
+//
+// One rule per line: <wrap|rewrite|pass> <exact|tool|prefix|suffix> <pattern> [role] [wrapper]
+// "exact" compares the whole basename, "tool" the part after the last '-'.
+// The role, "compiler" or "binutils", is only read by the wrapper and the
+// preload library, which load the same table from the rules parameter.
+// A matching pass rule always wins; otherwise the most specific wrap rule
+// (exact, suffix, prefix, tool) picks the wrapper, defaulting to wrapper_path.
+// Rewrite rules behave like wrap rules unless rewrite_mode is set.
+
+#define RULE_PATTERN_MAX 64
+
+enum rule_kind {
+    RULE_EXACT,
+    RULE_SUFFIX,
+    RULE_PREFIX,
+    RULE_TOOL,
+    RULE_KINDS,
+};
+
+enum rule_action {
+    RULE_WRAP,
+    RULE_PASS,
+    RULE_REWRITE,
+};
+
+static const char *const rule_kind_names[RULE_KINDS] = {"exact", "suffix", "prefix", "tool"};
+static const char *const rule_role_names[] = {"compiler", "binutils"};
+
+struct interceptor_rule {
+    struct hlist_node node;
+    enum rule_kind kind;
+    enum rule_action action;
+    unsigned int len;
+    struct interceptor_wrapper *wrapper;
+    char pattern[RULE_PATTERN_MAX];
+};
+
+struct interceptor_rules {
+    unsigned int hash_bits;
+    unsigned int nr_rules;
+    u64 len_mask[RULE_KINDS];
+    struct hlist_head *buckets;
+    u64 __percpu *hits;
+    char *source;
+    struct interceptor_rule rules[];
+};
+
+static const char default_rules[] =
+    "rewrite tool gcc\n"
+    "rewrite tool g++\n"
+    "rewrite tool c++\n"
+    "rewrite tool cc\n"
+    "wrap tool xgcc\n"
+    "wrap tool xg++\n"
+    "wrap tool ar\n"
+    "wrap tool nm\n"
+    "wrap tool ranlib\n"
+    "wrap exact nm-new\n"
+    "pass suffix gcc-ar\n"
+    "pass suffix gcc-nm\n"
+    "pass suffix gcc-ranlib\n";
+
+static struct interceptor_rules __rcu *active_rules;
+static DEFINE_MUTEX(rules_mutex);
+
+static struct hlist_head *rules_bucket(struct interceptor_rules *rules, enum rule_kind kind, const char *str, unsigned int len) {
+    return &rules->buckets[hash_32(jhash(str, len, kind), rules->hash_bits)];
+}
+
+static struct interceptor_rule *rules_find(struct interceptor_rules *rules, enum rule_kind kind, const char *str, unsigned int len) {
+    struct interceptor_rule *rule;
+    hlist_for_each_entry(rule, rules_bucket(rules, kind, str, len), node) {
+        if (rule->kind == kind && rule->len == len && memcmp(rule->pattern, str, len) == 0) {
+            return rule;
+        }
+    }
+    return NULL;
+}
+
+// Records a candidate; returns true if a pass rule ends the search.
+static bool rules_pick(struct interceptor_rule **match, struct interceptor_rule *rule) {
+    if (!rule) {
+        return false;
+    }
+    if (rule->action == RULE_PASS) {
+        return true;
+    }
+    if (!*match) {
+        *match = rule;
+    }
+    return false;
+}
+
+// Every lookup is a hash probe. Prefix and suffix rules are probed once per
+// distinct pattern length, which is bounded by RULE_PATTERN_MAX.
+static struct interceptor_rule *rules_match(struct interceptor_rules *rules, const char *pathname) {
+    const char *name = get_basename(pathname, '/');
+    const char *tool = get_basename(name, '-');
+    unsigned int name_len = strlen(name);
+    struct interceptor_rule *match = NULL;
+    u64 lens;
+
+    if (name_len == 0) {
+        return NULL;
+    }
+    if (name_len < RULE_PATTERN_MAX && rules_pick(&match, rules_find(rules, RULE_EXACT, name, name_len))) {
+        return NULL;
+    }
+    lens = rules->len_mask[RULE_SUFFIX] & GENMASK_ULL(min_t(unsigned int, name_len, RULE_PATTERN_MAX - 1), 1);
+    for (; lens; lens &= lens - 1) {
+        unsigned int len = __ffs64(lens);
+        if (rules_pick(&match, rules_find(rules, RULE_SUFFIX, name + name_len - len, len))) {
+            return NULL;
+        }
+    }
+    lens = rules->len_mask[RULE_PREFIX] & GENMASK_ULL(min_t(unsigned int, name_len, RULE_PATTERN_MAX - 1), 1);
+    for (; lens; lens &= lens - 1) {
+        unsigned int len = __ffs64(lens);
+        if (rules_pick(&match, rules_find(rules, RULE_PREFIX, name, len))) {
+            return NULL;
+        }
+    }
+    if (strlen(tool) < RULE_PATTERN_MAX && rules_pick(&match, rules_find(rules, RULE_TOOL, tool, strlen(tool)))) {
+        return NULL;
+    }
+    return match;
+}
+
+static void rules_free(struct interceptor_rules *rules) {
+    if (!rules) {
+        return;
+    }
+    for (unsigned int i = 0; i < rules->nr_rules; i++) {
+        wrapper_put(rules->rules[i].wrapper);
+    }
+    free_percpu(rules->hits);
+    kfree(rules->buckets);
+    kfree(rules->source);
+    kfree(rules);
+}
+
+static char *next_token(char **line) {
+    if (!*line) {
+        return NULL;
+    }
+    *line = skip_spaces(*line);
+    if (!**line) {
+        return NULL;
+    }
+    return strsep(line, " \t\n");
+}
+
+static int rules_parse_line(struct interceptor_rules *rules, char *line) {
+    struct interceptor_rule *rule = &rules->rules[rules->nr_rules];
+    char *action = next_token(&line);
+    char *kind = next_token(&line);
+    char *pattern = next_token(&line);
+    char *wrapper = next_token(&line);
+    int i;
 
-static int match_list(const char *str, char *const list[]) {
-    for (int i = 0; list[i] != NULL; i++) {
-        if (strcmp(str, list[i]) == 0) {
-            return i + 1;
+    if (!action || action[0] == '#') {
+        return 0;
+    }
+    if (wrapper && match_string(rule_role_names, ARRAY_SIZE(rule_role_names), wrapper) >= 0) {
+        wrapper = next_token(&line);
+    }
+    if (!kind || !pattern || next_token(&line)) {
+        return -EINVAL;
+    }
+    if (strcmp(action, "wrap") == 0) {
+        rule->action = RULE_WRAP;
+    } else if (strcmp(action, "pass") == 0) {
+        rule->action = RULE_PASS;
+    } else if (strcmp(action, "rewrite") == 0) {
+        rule->action = RULE_REWRITE;
+    } else {
+        return -EINVAL;
+    }
+    i = match_string(rule_kind_names, RULE_KINDS, kind);
+    if (i < 0) {
+        return -EINVAL;
+    }
+    rule->kind = i;
+    rule->len = strlen(pattern);
+    if (rule->len >= RULE_PATTERN_MAX) {
+        return -ENAMETOOLONG;
+    }
+    memcpy(rule->pattern, pattern, rule->len + 1);
+    if (rules_find(rules, rule->kind, rule->pattern, rule->len)) {
+        return -EEXIST;
+    }
+    if (wrapper) {
+        for (i = 0; i < (int)rules->nr_rules; i++) {
+            if (rules->rules[i].wrapper && strcmp(rules->rules[i].wrapper->name, wrapper) == 0) {
+                rule->wrapper = rules->rules[i].wrapper;
+                refcount_inc(&rule->wrapper->ref);
+                break;
+            }
+        }
+        if (!rule->wrapper) {
+            rule->wrapper = wrapper_resolve(wrapper);
+            if (IS_ERR(rule->wrapper)) {
+                int err = PTR_ERR(rule->wrapper);
+                rule->wrapper = NULL;
+                return err;
+            }
         }
     }
+    rules->len_mask[rule->kind] |= BIT_ULL(rule->len);
+    hlist_add_head(&rule->node, rules_bucket(rules, rule->kind, rule->pattern, rule->len));
+    rules->nr_rules++;
     return 0;
 }
 
-static char *get_basename(const char *path, const char delimiter) {
-    char *last_char = strrchr(path, delimiter);
-    if (last_char != NULL) {
-        return last_char + 1;
+static struct interceptor_rules *rules_parse(const char *source) {
+    struct interceptor_rules *rules;
+    unsigned int max_rules = 1;
+    unsigned int line_nr = 0;
+    char *buf, *cursor, *line;
+    int err = 0;
+
+    for (const char *c = source; *c; c++) {
+        max_rules += *c == '\n';
     }
-    return (char *)path;
+    rules = kzalloc(struct_size(rules, rules, max_rules), GFP_KERNEL);
+    if (!rules) {
+        return ERR_PTR(-ENOMEM);
+    }
+    rules->hash_bits = order_base_2(max_rules * 2);
+    rules->buckets = kcalloc(1U << rules->hash_bits, sizeof(*rules->buckets), GFP_KERNEL);
+    rules->hits = __alloc_percpu(sizeof(u64) * max_rules, __alignof__(u64));
+    rules->source = kstrdup(source, GFP_KERNEL);
+    buf = kstrdup(source, GFP_KERNEL);
+    if (!rules->buckets || !rules->hits || !rules->source || !buf) {
+        kfree(buf);
+        rules_free(rules);
+        return ERR_PTR(-ENOMEM);
+    }
+    cursor = buf;
+    while (!err && (line = strsep(&cursor, "\n")) != NULL) {
+        line_nr++;
+        err = rules_parse_line(rules, line);
+    }
+    kfree(buf);
+    if (err) {
+        pr_warn("rules: line %u: error %d\n", line_nr, err);
+        rules_free(rules);
+        return ERR_PTR(err);
+    }
+    return rules;
 }
 
-static int file_exists(const char *path) {
-    struct file *file = filp_open(path, O_RDONLY, 0);
-    if (!IS_ERR(file)) {
-        filp_close(file, NULL);
-        return 1;
+static int rules_load(const char *source) {
+    struct interceptor_rules *rules = rules_parse(source);
+    struct interceptor_rules *old;
+
+    if (IS_ERR(rules)) {
+        return PTR_ERR(rules);
+    }
+    mutex_lock(&rules_mutex);
+    old = rcu_replace_pointer(active_rules, rules, lockdep_is_held(&rules_mutex));
+    mutex_unlock(&rules_mutex);
+    if (old) {
+        synchronize_rcu();
+        rules_free(old);
     }
     return 0;
 }
 
+// Re-parsing the current source also re-resolves per-rule wrappers.
+static int rules_reload(void) {
+    struct interceptor_rules *rules;
+    char *source = NULL;
+    int err;
+
+    mutex_lock(&rules_mutex);
+    rules = rcu_dereference_protected(active_rules, lockdep_is_held(&rules_mutex));
+    if (rules) {
+        source = kstrdup(rules->source, GFP_KERNEL);
+    }
+    mutex_unlock(&rules_mutex);
+    if (rules && !source) {
+        return -ENOMEM;
+    }
+    err = rules_load(source ? source : default_rules);
+    kfree(source);
+    return err;
+}
+
+static int rules_set(const char *val, const struct kernel_param *kp) {
+    return rules_load(val);
+}
+
+static int rules_get(char *buffer, const struct kernel_param *kp) {
+    struct interceptor_rules *rules;
+    int len = 0;
+
+    mutex_lock(&rules_mutex);
+    rules = rcu_dereference_protected(active_rules, lockdep_is_held(&rules_mutex));
+    if (rules) {
+        len = scnprintf(buffer, PAGE_SIZE, "%s", rules->source);
+    }
+    mutex_unlock(&rules_mutex);
+    return len;
+}
+
+static const struct kernel_param_ops rules_ops = {
+    .set = rules_set,
+    .get = rules_get,
+};
+module_param_cb(rules, &rules_ops, NULL, 0644);
+MODULE_PARM_DESC(rules, "Match rule table, one rule per line");
+
+static int wrapper_reload_set(const char *val, const struct kernel_param *kp) {
+    int err;
+    mutex_lock(&wrapper_mutex);
+    err = wrapper_reload_locked();
+    mutex_unlock(&wrapper_mutex);
+    return rules_reload() ?: err;
+}
+
+static const struct kernel_param_ops wrapper_reload_ops = {
+    .set = wrapper_reload_set,
+};
+module_param_cb(reload, &wrapper_reload_ops, NULL, 0200);
+MODULE_PARM_DESC(reload, "Write anything to re-resolve the wrapper and rules");
+
 ////////////////////////////////////////////////////////////////////////////////
+// Argument Rewriting
+//
+// With rewrite_mode set, rewrite rules skip the wrapper: -O*, -march= and
+// -mtune= are dropped and rewrite_flags are appended while the bprm is built.
+// Probes (-v, --version, conftest) run unchanged, and the wrapper is used
+// whenever argv cannot be inspected.
+
+#define REWRITE_ARG_MAX 256
+
+static const char default_rewrite_flags[] =
+    "-march=native -mtune=native -pipe -Wno-error -O3 -fuse-ld=gold "
+    "-fgraphite-identity -floop-nest-optimize -fipa-pta "
+    "-fno-semantic-interposition -fno-common -fdevirtualize-at-ltrans "
+    "-fno-plt -ffunction-sections -fdata-sections -mtls-dialect=gnu2 "
+    "-malign-data=cacheline -Wl,-O2 -Wl,--gc-sections";
+
+struct rewrite_flags {
+    refcount_t ref;
+    struct rcu_head rcu;
+    int count;
+    char *argv[];
+};
+
+enum rewrite_arg {
+    REWRITE_KEEP,
+    REWRITE_DROP,
+    REWRITE_PROBE,
+};
+
+static bool rewrite_mode;
+module_param(rewrite_mode, bool, 0644);
+MODULE_PARM_DESC(rewrite_mode, "Rewrite compiler arguments in the kernel instead of calling the wrapper");
+
+static struct rewrite_flags __rcu *active_flags;
+static DEFINE_MUTEX(flags_mutex);
+
+static struct rewrite_flags *rewrite_flags_parse(const char *source) {
+    size_t len = strlen(source);
+    size_t max_count = len / 2 + 1;
+    struct rewrite_flags *flags;
+    char *cursor, *token;
+
+    flags = kzalloc(struct_size(flags, argv, max_count) + len + 1, GFP_KERNEL);
+    if (!flags) {
+        return ERR_PTR(-ENOMEM);
+    }
+    cursor = (char *)&flags->argv[max_count];
+    memcpy(cursor, source, len + 1);
+    while ((token = next_token(&cursor)) != NULL) {
+        flags->argv[flags->count++] = token;
+    }
+    refcount_set(&flags->ref, 1);
+    return flags;
+}
+
+static void rewrite_flags_put(struct rewrite_flags *flags) {
+    if (flags && refcount_dec_and_test(&flags->ref)) {
+        kfree_rcu(flags, rcu);
+    }
+}
+
+static int rewrite_flags_load(const char *source) {
+    struct rewrite_flags *flags = rewrite_flags_parse(source);
+    if (IS_ERR(flags)) {
+        return PTR_ERR(flags);
+    }
+    mutex_lock(&flags_mutex);
+    flags = rcu_replace_pointer(active_flags, flags, lockdep_is_held(&flags_mutex));
+    mutex_unlock(&flags_mutex);
+    rewrite_flags_put(flags);
+    return 0;
+}
+
+static int rewrite_flags_set(const char *val, const struct kernel_param *kp) {
+    return rewrite_flags_load(val);
+}
+
+static int rewrite_flags_get(char *buffer, const struct kernel_param *kp) {
+    struct rewrite_flags *flags;
+    int len = 0;
+
+    mutex_lock(&flags_mutex);
+    flags = rcu_dereference_protected(active_flags, lockdep_is_held(&flags_mutex));
+    for (int i = 0; flags && i < flags->count; i++) {
+        len += scnprintf(buffer + len, PAGE_SIZE - len, "%s%s", i ? " " : "", flags->argv[i]);
+    }
+    mutex_unlock(&flags_mutex);
+    len += scnprintf(buffer + len, PAGE_SIZE - len, "\n");
+    return len;
+}
+
+static const struct kernel_param_ops rewrite_flags_ops = {
+    .set = rewrite_flags_set,
+    .get = rewrite_flags_get,
+};
+module_param_cb(rewrite_flags, &rewrite_flags_ops, NULL, 0644);
+MODULE_PARM_DESC(rewrite_flags, "Flags appended by in-kernel rewriting");
+
+static enum rewrite_arg rewrite_classify(const char *arg) {
+    if (strcmp(arg, "-v") == 0 ||
+        strcmp(arg, "-V") == 0 ||
+        strcmp(arg, "--version") == 0 ||
+        strcmp(arg, "-qversion") == 0 ||
+        strncmp(get_basename(arg, '/'), "conftest", 8) == 0) {
+        return REWRITE_PROBE;
+    }
+    if ((strncmp(arg, "-O", 2) == 0 && strcmp(arg, "-Ofast") != 0) ||
+        strncmp(arg, "-march=", 7) == 0 ||
+        strncmp(arg, "-mtune=", 7) == 0) {
+        return REWRITE_DROP;
+    }
+    return REWRITE_KEEP;
+}
+
+// Marks the arguments to drop in skip and returns how many there are, or
+// -EAGAIN for a probe. argv[0] is always kept, and arguments longer than
+// REWRITE_ARG_MAX are kept without being classified.
+static int rewrite_scan(struct user_arg_ptr argv, int argc, unsigned long *skip) {
+    char arg[REWRITE_ARG_MAX];
+    int dropped = 0;
 
-static int do_execveat_common(int fd, struct filename *filename, struct user_arg_ptr argv, struct user_arg_ptr envp, int flags) {
+    for (int i = 1; i < argc; i++) {
+        const char __user *str = get_user_arg_ptr(argv, i);
+        long len;
+        if (IS_ERR(str)) {
+            return PTR_ERR(str);
+        }
+        len = strncpy_from_user(arg, str, sizeof(arg));
+        if (len < 0) {
+            return len;
+        }
+        if (len == sizeof(arg)) {
+            continue;
+        }
+        switch (rewrite_classify(arg)) {
+        case REWRITE_PROBE:
+            return -EAGAIN;
+        case REWRITE_DROP:
+            __set_bit(i, skip);
+            dropped++;
+            break;
+        case REWRITE_KEEP:
+            break;
+        }
+        if (fatal_signal_pending(current)) {
+            return -ERESTARTNOHAND;
+        }
+        cond_resched();
+    }
+    return dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Cgroup Scope
+//
+// With a non-empty scope only tasks inside one of the listed cgroup v2
+// subtrees are intercepted; every other exec goes straight to the kernel
+// after one ancestor check per listed cgroup.
+
+#ifdef CONFIG_CGROUPS
+struct interceptor_scope {
+    int count;
+    char *source;
+    struct cgroup *cgroups[];
+};
+
+static struct interceptor_scope __rcu *active_scope;
+static DEFINE_MUTEX(scope_mutex);
+
+static void scope_free(struct interceptor_scope *scope) {
+    if (!scope) {
+        return;
+    }
+    for (int i = 0; i < scope->count; i++) {
+        cgroup_put(scope->cgroups[i]);
+    }
+    kfree(scope->source);
+    kfree(scope);
+}
+
+static struct interceptor_scope *scope_parse(const char *source) {
+    size_t max_count = strlen(source) / 2 + 1;
+    struct interceptor_scope *scope;
+    char *buf, *cursor, *path;
+    int err = 0;
+
+    scope = kzalloc(struct_size(scope, cgroups, max_count), GFP_KERNEL);
+    buf = kstrdup(source, GFP_KERNEL);
+    if (scope) {
+        scope->source = kstrdup(source, GFP_KERNEL);
+    }
+    if (!scope || !buf || !scope->source) {
+        kfree(buf);
+        scope_free(scope);
+        return ERR_PTR(-ENOMEM);
+    }
+    cursor = buf;
+    while (!err && (path = next_token(&cursor)) != NULL) {
+        struct cgroup *cgrp = cgroup_get_from_path(path);
+        if (IS_ERR(cgrp)) {
+            pr_warn("scope: %s: error %ld\n", path, PTR_ERR(cgrp));
+            err = PTR_ERR(cgrp);
+        } else {
+            scope->cgroups[scope->count++] = cgrp;
+        }
+    }
+    kfree(buf);
+    if (err) {
+        scope_free(scope);
+        return ERR_PTR(err);
+    }
+    if (!scope->count) {
+        scope_free(scope);
+        return NULL;
+    }
+    return scope;
+}
+
+static bool interceptor_in_scope(void) {
+    struct interceptor_scope *scope;
+    bool in_scope = true;
+
+    rcu_read_lock();
+    scope = rcu_dereference(active_scope);
+    if (scope) {
+        struct cgroup *cgrp = task_dfl_cgroup(current);
+        in_scope = false;
+        for (int i = 0; i < scope->count && !in_scope; i++) {
+            in_scope = cgroup_is_descendant(cgrp, scope->cgroups[i]);
+        }
+    }
+    rcu_read_unlock();
+    return in_scope;
+}
+
+static int scope_set(const char *val, const struct kernel_param *kp) {
+    struct interceptor_scope *scope = scope_parse(val);
+    if (IS_ERR(scope)) {
+        return PTR_ERR(scope);
+    }
+    mutex_lock(&scope_mutex);
+    scope = rcu_replace_pointer(active_scope, scope, lockdep_is_held(&scope_mutex));
+    mutex_unlock(&scope_mutex);
+    if (scope) {
+        synchronize_rcu();
+        scope_free(scope);
+    }
+    return 0;
+}
+
+static int scope_get(char *buffer, const struct kernel_param *kp) {
+    struct interceptor_scope *scope;
+    int len;
+
+    mutex_lock(&scope_mutex);
+    scope = rcu_dereference_protected(active_scope, lockdep_is_held(&scope_mutex));
+    len = scnprintf(buffer, PAGE_SIZE, "%s\n", scope ? strim(scope->source) : "");
+    mutex_unlock(&scope_mutex);
+    return len;
+}
+
+static void scope_exit(void) {
+    scope_free(rcu_replace_pointer(active_scope, NULL, 1));
+}
+
+static const struct kernel_param_ops scope_ops = {
+    .set = scope_set,
+    .get = scope_get,
+};
+module_param_cb(cgroups, &scope_ops, NULL, 0644);
+MODULE_PARM_DESC(cgroups, "cgroup v2 paths whose tasks are intercepted (empty: all tasks)");
+#else
+static bool interceptor_in_scope(void) {
+    return true;
+}
+
+static void scope_exit(void) {
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exec Events
+//
+// Intercepted execs are recorded into per-CPU rings in a vmalloc area that
+// INTERCEPTOR_EVENTS_DEVICE maps into the consumer; see interceptor_events.h.
+// The producer runs with preemption disabled, so each ring has exactly one
+// writer. A full ring drops the event and counts it.
+
+static unsigned int events_per_cpu = 512;
+module_param(events_per_cpu, uint, 0444);
+MODULE_PARM_DESC(events_per_cpu, "Exec events buffered per CPU (power of two, 0 disables)");
+
+static void *events_area;
+static size_t events_size;
+
+static struct interceptor_event_ring *events_ring(unsigned int cpu) {
+    struct interceptor_events_header *header = events_area;
+    return events_area + header->ring_offset + cpu * header->ring_stride;
+}
+
+static void events_record(const char *filename, const char *rule, u32 flags) {
+    struct interceptor_event_ring *ring;
+    struct interceptor_event *event;
+    u64 head;
+
+    if (!events_area) {
+        return;
+    }
+    ring = events_ring(get_cpu());
+    head = ring->head;
+    if (head - smp_load_acquire(&ring->tail) >= events_per_cpu) {
+        WRITE_ONCE(ring->dropped, ring->dropped + 1);
+        put_cpu();
+        return;
+    }
+    event = (struct interceptor_event *)(ring + 1) + (head & (events_per_cpu - 1));
+    event->timestamp_ns = ktime_get_ns();
+    event->pid = task_tgid_nr(current);
+    event->ppid = task_ppid_nr(current);
+    event->flags = flags;
+    event->reserved = 0;
+    get_task_comm(event->comm, current);
+    strscpy_pad(event->rule, rule, sizeof(event->rule));
+    strscpy_pad(event->filename, filename, sizeof(event->filename));
+    smp_store_release(&ring->head, head + 1);
+    put_cpu();
+}
+
+static int events_mmap(struct file *file, struct vm_area_struct *vma) {
+    if (vma->vm_end - vma->vm_start > events_size - (vma->vm_pgoff << PAGE_SHIFT)) {
+        return -EINVAL;
+    }
+    return remap_vmalloc_range(vma, events_area, vma->vm_pgoff);
+}
+
+static const struct file_operations events_fops = {
+    .owner = THIS_MODULE,
+    .mmap = events_mmap,
+};
+
+static struct miscdevice events_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "interceptor-events",
+    .fops = &events_fops,
+    .mode = 0600,
+};
+
+static int events_init(void) {
+    struct interceptor_events_header *header;
+    size_t ring_offset = PAGE_ALIGN(sizeof(*header));
+    size_t ring_stride;
+    int err;
+
+    if (!events_per_cpu) {
+        return 0;
+    }
+    if (!is_power_of_2(events_per_cpu)) {
+        return -EINVAL;
+    }
+    ring_stride = PAGE_ALIGN(sizeof(struct interceptor_event_ring) + (size_t)events_per_cpu * sizeof(struct interceptor_event));
+    events_size = ring_offset + nr_cpu_ids * ring_stride;
+    events_area = vmalloc_user(events_size);
+    if (!events_area) {
+        return -ENOMEM;
+    }
+    header = events_area;
+    header->magic = INTERCEPTOR_EVENTS_MAGIC;
+    header->version = INTERCEPTOR_EVENTS_VERSION;
+    header->nr_cpus = nr_cpu_ids;
+    header->nr_events = events_per_cpu;
+    header->event_size = sizeof(struct interceptor_event);
+    header->ring_offset = ring_offset;
+    header->ring_stride = ring_stride;
+    err = misc_register(&events_device);
+    if (err) {
+        vfree(events_area);
+        events_area = NULL;
+    }
+    return err;
+}
+
+static void events_exit(void) {
+    if (events_area) {
+        misc_deregister(&events_device);
+        vfree(events_area);
+        events_area = NULL;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics
+//
+// Per-CPU counters and a log2 histogram of the time spent in
+// do_execveat_common() before bprm_execve(), shown in debugfs
+// interceptor/stats. Writing to interceptor/reset clears them.
+
+enum interceptor_stat {
+    STAT_EXECS,
+    STAT_BYPASSED,
+    STAT_OUT_OF_SCOPE,
+    STAT_UNMATCHED,
+    STAT_WRAPPED,
+    STAT_REWRITTEN,
+    STAT_UNCHANGED,
+    STAT_ALLOC_BPRM_ERRORS,
+    STAT_COPY_STRINGS_ERRORS,
+    STAT_COUNT,
+};
+
+static const char *const stat_names[STAT_COUNT] = {
+    "execs",
+    "bypassed",
+    "out_of_scope",
+    "unmatched",
+    "wrapped",
+    "rewritten",
+    "unchanged",
+    "alloc_bprm_errors",
+    "copy_strings_errors",
+};
+
+#define STAT_HIST_BUCKETS 64
+
+struct interceptor_stats {
+    u64 counters[STAT_COUNT];
+    u64 hist[STAT_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct interceptor_stats, interceptor_stats);
+static struct dentry *stats_dir;
+
+static void stat_inc(enum interceptor_stat stat) {
+    this_cpu_inc(interceptor_stats.counters[stat]);
+}
+
+static void stat_latency(u64 start_ns) {
+    u64 delta = ktime_get_ns() - start_ns;
+    this_cpu_inc(interceptor_stats.hist[delta ? ilog2(delta) : 0]);
+}
+
+static int stats_show(struct seq_file *m, void *v) {
+    struct interceptor_rules *rules;
+    int cpu;
+
+    for (int i = 0; i < STAT_COUNT; i++) {
+        u64 sum = 0;
+        for_each_possible_cpu(cpu) {
+            sum += per_cpu(interceptor_stats.counters[i], cpu);
+        }
+        seq_printf(m, "%s %llu\n", stat_names[i], sum);
+    }
+    rcu_read_lock();
+    rules = rcu_dereference(active_rules);
+    for (unsigned int i = 0; rules && i < rules->nr_rules; i++) {
+        u64 sum = 0;
+        for_each_possible_cpu(cpu) {
+            sum += per_cpu_ptr(rules->hits, cpu)[i];
+        }
+        seq_printf(m, "rule %s %s %llu\n", rule_kind_names[rules->rules[i].kind], rules->rules[i].pattern, sum);
+    }
+    rcu_read_unlock();
+    for (int i = 0; i < STAT_HIST_BUCKETS; i++) {
+        u64 sum = 0;
+        for_each_possible_cpu(cpu) {
+            sum += per_cpu(interceptor_stats.hist[i], cpu);
+        }
+        if (sum) {
+            seq_printf(m, "latency_ns %llu %llu\n", 1ULL << i, sum);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static ssize_t stats_reset_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos) {
+    struct interceptor_rules *rules;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(&interceptor_stats, cpu), 0, sizeof(struct interceptor_stats));
+    }
+    rcu_read_lock();
+    rules = rcu_dereference(active_rules);
+    if (rules) {
+        for_each_possible_cpu(cpu) {
+            memset(per_cpu_ptr(rules->hits, cpu), 0, sizeof(u64) * rules->nr_rules);
+        }
+    }
+    rcu_read_unlock();
+    return len;
+}
+
+static const struct file_operations stats_reset_fops = {
+    .owner = THIS_MODULE,
+    .write = stats_reset_write,
+};
+
+static void stats_init(void) {
+    stats_dir = debugfs_create_dir("interceptor", NULL);
+    debugfs_create_file("stats", 0400, stats_dir, NULL, &stats_fops);
+    debugfs_create_file("reset", 0200, stats_dir, NULL, &stats_reset_fops);
+}
+
+static void stats_exit(void) {
+    debugfs_remove_recursive(stats_dir);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Matching
+
+struct interceptor_target {
+    struct interceptor_wrapper *wrapper;
+    struct rewrite_flags *rewrite;
+    char rule[INTERCEPTOR_EVENT_RULE_LEN];
+};
+
+static void target_put(struct interceptor_target *target) {
+    wrapper_put(target->wrapper);
+    rewrite_flags_put(target->rewrite);
+    target->wrapper = NULL;
+    target->rewrite = NULL;
+}
+
+// Fills target with referenced objects. Returns false if pathname is not
+// intercepted or nothing is available to handle it.
+static bool interceptor_match(const char *pathname, struct interceptor_target *target) {
+    struct interceptor_wrapper *wrapper = NULL;
+    struct rewrite_flags *rewrite = NULL;
+    struct interceptor_rules *rules;
+    struct interceptor_rule *rule = NULL;
+    bool use_default = false;
+
+    rcu_read_lock();
+    rules = rcu_dereference(active_rules);
+    if (rules) {
+        rule = rules_match(rules, pathname);
+    }
+    if (rule) {
+        this_cpu_inc(rules->hits[rule - rules->rules]);
+        scnprintf(target->rule, sizeof(target->rule), "%s %s", rule_kind_names[rule->kind], rule->pattern);
+        wrapper = rule->wrapper;
+        use_default = !wrapper;
+        if (wrapper && !refcount_inc_not_zero(&wrapper->ref)) {
+            wrapper = NULL;
+        }
+        if (rule->action == RULE_REWRITE && READ_ONCE(rewrite_mode)) {
+            rewrite = rcu_dereference(active_flags);
+            if (rewrite && !refcount_inc_not_zero(&rewrite->ref)) {
+                rewrite = NULL;
+            }
+        }
+    }
+    rcu_read_unlock();
+
+    if (use_default) {
+        wrapper = wrapper_acquire();
+    }
+    if (wrapper && d_unlinked(wrapper->path.dentry)) {
+        wrapper_put(wrapper);
+        wrapper = NULL;
+    }
+    target->wrapper = wrapper;
+    target->rewrite = rewrite;
+    return wrapper || rewrite;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int do_execveat_common(int fd, struct filename *filename, struct user_arg_ptr argv, struct user_arg_ptr envp, int flags, struct interceptor_target *target) {
     struct linux_binprm *bprm;
+    u64 start_ns = ktime_get_ns();
     int retval;
 
     if (IS_ERR(filename)) {
+        target_put(target);
         return PTR_ERR(filename);
     }
 
-    if ((current->flags & PF_NPROC_EXCEEDED) && is_rlimit_overlimit(current_ucounts(), UCOUNT_RLIMIT_NPROC, rlimit(RLIMIT_NPROC))) {
-        retval = -EAGAIN;
-        goto out_ret;
-    }
-
     int call_wrapper = 0;
     struct filename *original_filename = NULL;
+    struct rewrite_flags *rewrite = target->rewrite;
+    unsigned long *skip = NULL;
+    int rewrite_argc = 0;
+    int dropped = 0;
     char *pathname = filename->name;
-    const char *basemame_slash = get_basename(pathname, '/');
-    const char *basename_dash = get_basename(basemame_slash, '-');
-    pr_info("%s %s",current->comm, pathname);
-    if (file_exists(INTERCEPTOR_WRAPPER_PATH)) {
-        call_wrapper = match_list(basename_dash, binutils_list);
-        if (call_wrapper && (strncmp(basename_dash - 4, "gcc-", 4) == 0)) {
-            call_wrapper = 0;
+    if (rewrite) {
+        rewrite_argc = count(argv, MAX_ARG_STRINGS);
+        dropped = rewrite_argc;
+        if (rewrite_argc >= 0) {
+            skip = bitmap_zalloc(max(rewrite_argc, 1), GFP_KERNEL);
+            dropped = skip ? rewrite_scan(argv, rewrite_argc, skip) : -ENOMEM;
+        }
+        if (dropped < 0) {
+            // Probes run unchanged; anything else falls back to the wrapper.
+            if (dropped == -EAGAIN) {
+                wrapper_put(target->wrapper);
+                target->wrapper = NULL;
+            }
+            bitmap_free(skip);
+            skip = NULL;
+            rewrite = NULL;
+            dropped = 0;
+        } else {
+            wrapper_put(target->wrapper);
+            target->wrapper = NULL;
         }
-        call_wrapper += match_list(basename_dash, gcc_compiler_list);
-        call_wrapper += match_list(basemame_slash, binutils_new_list);
     }
-    if (strcmp(current->comm, "interceptor") == 0 ||
-        strcmp(current->comm, "lto-wrapper") == 0) {
-        call_wrapper = 0;
+    if (target->wrapper) {
+        // struct filename carries a non-atomic refcount and a per-task audit
+        // back pointer, so it cannot be shared between concurrent execs. The
+        // cached path saves the lookup; this is only a names_cache copy.
+        struct filename *wrapper_filename = getname_kernel(target->wrapper->name);
+        if (!IS_ERR(wrapper_filename)) {
+            call_wrapper = 1;
+            original_filename = filename;
+            filename = wrapper_filename;
+        }
     }
-    if (call_wrapper) {
-        original_filename = filename;
-        filename = getname_kernel(INTERCEPTOR_WRAPPER_PATH);
+    wrapper_put(target->wrapper);
+    target->wrapper = NULL;
+    events_record(pathname, target->rule, (call_wrapper ? INTERCEPTOR_EVENT_WRAPPED : 0) | (rewrite ? INTERCEPTOR_EVENT_REWRITTEN : 0));
+    stat_inc(rewrite ? STAT_REWRITTEN : call_wrapper ? STAT_WRAPPED : STAT_UNCHANGED);
+
+    if ((current->flags & PF_NPROC_EXCEEDED) && is_rlimit_overlimit(current_ucounts(), UCOUNT_RLIMIT_NPROC, rlimit(RLIMIT_NPROC))) {
+        retval = -EAGAIN;
+        goto out_ret;
     }
 
     current->flags &= ~PF_NPROC_EXCEEDED;
 
     bprm = alloc_bprm(fd, filename);
     if (IS_ERR(bprm)) {
+        stat_inc(STAT_ALLOC_BPRM_ERRORS);
         retval = PTR_ERR(bprm);
         goto out_ret;
     }
@@ -328,10 +1411,17 @@ static int do_execveat_common(int fd, struct filename *filename, struct user_arg
     } else if (retval < 0) {
         goto out_free;
     }
+    if (rewrite && retval != rewrite_argc) {
+        retval = -EFAULT;
+        goto out_free;
+    }
     bprm->argc = retval;
     if (call_wrapper) {
         bprm->argc += 1;
     }
+    if (rewrite) {
+        bprm->argc += rewrite->count - dropped;
+    }
 
     retval = count(envp, MAX_ARG_STRINGS);
     if (retval < 0) {
@@ -350,18 +1440,31 @@ static int do_execveat_common(int fd, struct filename *filename, struct user_arg
     }
     bprm->exec = bprm->p;
 
-    retval = copy_strings(bprm->envc, envp, bprm);
+    retval = copy_strings(bprm->envc, envp, bprm, NULL);
     if (retval < 0) {
+        stat_inc(STAT_COPY_STRINGS_ERRORS);
         goto out_free;
     }
 
-    if (call_wrapper) {
-        retval = copy_strings(bprm->argc - 1, argv, bprm);
-        copy_string_kernel(original_filename->name, bprm);
+    if (rewrite) {
+        // Strings are pushed backwards, so the appended flags go first.
+        for (int i = rewrite->count - 1; i >= 0; i--) {
+            retval = copy_string_kernel(rewrite->argv[i], bprm);
+            if (retval < 0) {
+                goto out_free;
+            }
+        }
+        retval = copy_strings(rewrite_argc, argv, bprm, skip);
+    } else if (call_wrapper) {
+        retval = copy_strings(bprm->argc - 1, argv, bprm, NULL);
+        if (retval >= 0) {
+            retval = copy_string_kernel(original_filename->name, bprm);
+        }
     } else {
-        retval = copy_strings(bprm->argc, argv, bprm);
+        retval = copy_strings(bprm->argc, argv, bprm, NULL);
     }
     if (retval < 0) {
+        stat_inc(STAT_COPY_STRINGS_ERRORS);
         goto out_free;
     }
 
@@ -373,7 +1476,11 @@ static int do_execveat_common(int fd, struct filename *filename, struct user_arg
         bprm->argc = 1;
     }
 
+    stat_latency(start_ns);
     retval = bprm_execve(bprm, fd, filename, flags);
+    if (retval == 0 && (call_wrapper || rewrite)) {
+        interceptor_mark();
+    }
 out_free:
     free_bprm(bprm);
 
@@ -382,6 +1489,8 @@ out_ret:
     if (call_wrapper) {
         putname(original_filename);
     }
+    bitmap_free(skip);
+    target_put(target);
     return retval;
 }
 
@@ -392,15 +1501,100 @@ static long khook___x64_sys_execve(const struct pt_regs *regs) {
     const char __user *pathname = (const char __user *)regs->di;
     const char __user *const __user *argv = (const char __user *const __user *)regs->si;
     const char __user *const __user *envp = (const char __user *const __user *)regs->dx;
-    return do_execve(getname(pathname), argv, envp);
+    struct interceptor_target target = {};
+    bool matched = false;
+    struct filename *filename;
+    char name[INTERCEPTOR_NAME_MAX];
+    long len;
+
+    // Anything that cannot be rewritten goes straight to the running kernel.
+    // Names too long for the buffer are classified after getname().
+    stat_inc(STAT_EXECS);
+    if (interceptor_bypass()) {
+        stat_inc(STAT_BYPASSED);
+        return KHOOK_ORIGIN(__x64_sys_execve, regs);
+    }
+    if (!interceptor_in_scope()) {
+        stat_inc(STAT_OUT_OF_SCOPE);
+        return KHOOK_ORIGIN(__x64_sys_execve, regs);
+    }
+    len = strncpy_from_user(name, pathname, sizeof(name));
+    if (len < 0) {
+        return KHOOK_ORIGIN(__x64_sys_execve, regs);
+    }
+    if (len < (long)sizeof(name)) {
+        matched = interceptor_match(name, &target);
+        if (!matched) {
+            stat_inc(STAT_UNMATCHED);
+            return KHOOK_ORIGIN(__x64_sys_execve, regs);
+        }
+    }
+    filename = getname(pathname);
+    if (IS_ERR(filename)) {
+        target_put(&target);
+        return PTR_ERR(filename);
+    }
+    // The kernel copy decides if userspace changed the name in between.
+    if (!matched || strcmp(filename->name, name) != 0) {
+        target_put(&target);
+        matched = interceptor_match(filename->name, &target);
+    }
+    if (!matched) {
+        stat_inc(STAT_UNMATCHED);
+        putname(filename);
+        return KHOOK_ORIGIN(__x64_sys_execve, regs);
+    }
+    return do_execve(filename, argv, envp, &target);
+}
+
+static void wrapper_release(void) {
+    scope_exit();
+    rewrite_flags_put(rcu_replace_pointer(active_flags, NULL, 1));
+    rules_free(rcu_replace_pointer(active_rules, NULL, 1));
+    wrapper_put(rcu_replace_pointer(cached_wrapper, NULL, 1));
+    rcu_barrier();
 }
 
 int init_module(void) {
-    return khook_init();
+    int err;
+    if (!rcu_access_pointer(active_flags)) {
+        err = rewrite_flags_load(default_rewrite_flags);
+        if (err) {
+            return err;
+        }
+    }
+    if (!rcu_access_pointer(active_rules)) {
+        err = rules_load(default_rules);
+        if (err) {
+            wrapper_release();
+            return err;
+        }
+    }
+    mutex_lock(&wrapper_mutex);
+    if (!rcu_access_pointer(cached_wrapper)) {
+        wrapper_reload_locked();
+    }
+    mutex_unlock(&wrapper_mutex);
+    err = events_init();
+    if (err) {
+        wrapper_release();
+        return err;
+    }
+    stats_init();
+    err = khook_init();
+    if (err) {
+        stats_exit();
+        events_exit();
+        wrapper_release();
+    }
+    return err;
 }
 
 void cleanup_module(void) {
     khook_cleanup();
+    stats_exit();
+    events_exit();
+    wrapper_release();
 }
 
 MODULE_LICENSE("GPL");
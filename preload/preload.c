@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../wrapper/rewrite.h"
+#include "../wrapper/rules.h"
+#include "../wrapper/trace.h"
+
+// LD_PRELOAD interception for hosts that can't load interceptor-km.
+//
+// The exec family and posix_spawn are hooked in libc. Execs of matching
+// compilers and binutils are rewritten in-process with the wrapper's rules, so
+// nothing goes through the kernel hook or a second exec of the wrapper. A
+// rewritten exec drops this library from the child's LD_PRELOAD, so the
+// compiler's own children run untouched, like the tree mark of the module.
+//
+// vfork+exec is covered by the execve hook. A vfork child shares the parent's
+// memory and must not touch its heap or fork, so there the rewrite takes its
+// memory from a stack arena and uses only resolutions that are already
+// cached. If the arena runs out, the exec runs as it is.
+//
+// Build with -fvisibility=hidden so that only the hooks are exported.
+
+#define PRELOAD_EXPORT __attribute__((visibility("default")))
+
+// Bytes of stack the rewrite of an exec in a vfork child may use.
+#define PRELOAD_ARENA_BYTES (128 * 1024)
+
+extern char **environ;
+
+typedef int (*execve_fn)(const char *, char *const[], char *const[]);
+typedef int (*posix_spawn_fn)(pid_t *, const char *, const posix_spawn_file_actions_t *,
+                              const posix_spawnattr_t *, char *const[], char *const[]);
+
+// Resolved when the library loads, since dlsym may allocate.
+execve_fn next_execve;
+execve_fn next_execvpe;
+posix_spawn_fn next_posix_spawn;
+posix_spawn_fn next_posix_spawnp;
+
+// The process this memory belongs to. Fork handlers keep it current; a vfork
+// child, which shares the memory and runs no handlers, sees another pid.
+pid_t preload_pid;
+
+void *next_symbol(const char *name) {
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (!sym) {
+        fprintf(stderr, "interceptor: %s not found\n", name);
+        abort();
+    }
+    return sym;
+}
+
+void preload_forked(void) {
+    preload_pid = getpid();
+}
+
+__attribute__((constructor)) void preload_init(void) {
+    next_execve = (execve_fn)next_symbol("execve");
+    next_execvpe = (execve_fn)next_symbol("execvpe");
+    next_posix_spawn = (posix_spawn_fn)next_symbol("posix_spawn");
+    next_posix_spawnp = (posix_spawn_fn)next_symbol("posix_spawnp");
+    preload_pid = getpid();
+    pthread_atfork(NULL, NULL, preload_forked);
+    rules_load();
+}
+
+// Returns envp without this library in LD_PRELOAD, or envp if it isn't there.
+// The copy is allocated for exec.
+char **strip_preload(struct interceptor_exec *exec, char *const envp[]) {
+    Dl_info info;
+    if (!dladdr((void *)strip_preload, &info) || !info.dli_fname) {
+        return (char **)envp;
+    }
+    const char *self = get_basename(info.dli_fname, '/');
+
+    int envc = 0;
+    int preload = -1;
+    for (; envp[envc]; envc++) {
+        if (preload < 0 && strings_equal_n(envp[envc], "LD_PRELOAD=")) {
+            preload = envc;
+        }
+    }
+    if (preload < 0) {
+        return (char **)envp;
+    }
+
+    const char *value = envp[preload] + strlen("LD_PRELOAD=");
+    char *new_value = exec_alloc(exec, strlen(envp[preload]) + 1);
+    char **new_envp = exec_alloc(exec, (envc + 1) * sizeof(char *));
+    strcpy(new_value, "LD_PRELOAD=");
+    int new_len = strlen(new_value);
+    int empty = 1;
+    while (*value) {
+        int len = strcspn(value, ": ");
+        if (len) {
+            const char *entry_end = value + len;
+            const char *entry_base = entry_end;
+            while (entry_base > value && entry_base[-1] != '/') {
+                entry_base--;
+            }
+            if ((size_t)(entry_end - entry_base) != strlen(self) ||
+                strncmp(entry_base, self, entry_end - entry_base) != 0) {
+                if (!empty) {
+                    new_value[new_len++] = ':';
+                }
+                memcpy(new_value + new_len, value, len);
+                new_len += len;
+                empty = 0;
+            }
+        }
+        value += len;
+        if (*value) {
+            value++;
+        }
+    }
+    new_value[new_len] = '\0';
+
+    int new_envc = 0;
+    for (int i = 0; i < envc; i++) {
+        if (i != preload) {
+            // The loader only reads the first LD_PRELOAD; drop any others.
+            if (!strings_equal_n(envp[i], "LD_PRELOAD=")) {
+                new_envp[new_envc++] = envp[i];
+            }
+        } else if (!empty) {
+            new_envp[new_envc++] = new_value;
+        }
+    }
+    new_envp[new_envc] = NULL;
+    return new_envp;
+}
+
+// Rewrites an exec of pathname, allocating from exec->arena if the caller set
+// one. Returns nonzero if exec and *new_envp were changed.
+int preload_rewrite(const char *pathname, char *const argv[], char *const envp[],
+                    struct interceptor_exec *exec, char ***new_envp) {
+    exec->pathname = (char *)pathname;
+    exec->argv = (char **)argv;
+    exec->rsp_fd = -1;
+    exec->allocations = NULL;
+    *new_envp = (char **)envp;
+    if (!pathname || !argv || !argv[0] || !interceptor_matches(pathname)) {
+        return 0;
+    }
+    if (exec->arena && setjmp(exec->arena->full)) {
+        // Out of arena memory.
+        interceptor_exec_release(exec);
+        exec->pathname = (char *)pathname;
+        exec->argv = (char **)argv;
+        *new_envp = (char **)envp;
+        return 0;
+    }
+    if (!interceptor_rewrite((char *)pathname, (char **)argv, exec)) {
+        return 0;
+    }
+    // The compiler runs without us, so there is no end time to record.
+    if (exec->compiler && trace_enabled()) {
+        trace_record(exec, trace_now(), 0, -1);
+    }
+    *new_envp = strip_preload(exec, envp);
+    return 1;
+}
+
+// Finds file in PATH the way execvp does. Returns 0 and fills path, or -1.
+int resolve_path(const char *file, char *path, size_t size) {
+    const char *search = getenv("PATH");
+    if (!search) {
+        search = "/bin:/usr/bin";
+    }
+    while (*search) {
+        int len = strcspn(search, ":");
+        if (len) {
+            snprintf(path, size, "%.*s/%s", len, search, file);
+        } else {
+            snprintf(path, size, "%s", file);
+        }
+        if (access(path, X_OK) == 0) {
+            return 0;
+        }
+        search += len;
+        if (*search) {
+            search++;
+        }
+    }
+    return -1;
+}
+
+// The execve of a vfork child. The rewrite lives in this frame, which the
+// parent gets back whether or not the exec succeeds.
+int execve_vfork(const char *pathname, char *const argv[], char *const envp[]) {
+    char data[PRELOAD_ARENA_BYTES] __attribute__((aligned(16)));
+    struct exec_arena arena;
+    struct interceptor_exec exec;
+    char **new_envp;
+
+    arena.data = data;
+    arena.size = sizeof(data);
+    arena.used = 0;
+    exec.arena = &arena;
+    if (!preload_rewrite(pathname, argv, envp, &exec, &new_envp)) {
+        return next_execve(pathname, argv, envp);
+    }
+    int res = next_execve(exec.pathname, exec.argv, new_envp);
+    int saved_errno = errno;
+    interceptor_exec_release(&exec);
+    errno = saved_errno;
+    return res;
+}
+
+PRELOAD_EXPORT int execve(const char *pathname, char *const argv[], char *const envp[]) {
+    struct interceptor_exec exec;
+    char **new_envp;
+
+    if (getpid() != preload_pid) {
+        return execve_vfork(pathname, argv, envp);
+    }
+    exec.arena = NULL;
+    if (!preload_rewrite(pathname, argv, envp, &exec, &new_envp)) {
+        return next_execve(pathname, argv, envp);
+    }
+    int res = next_execve(exec.pathname, exec.argv, new_envp);
+    int saved_errno = errno;
+    interceptor_exec_release(&exec);
+    errno = saved_errno;
+    return res;
+}
+
+PRELOAD_EXPORT int execv(const char *pathname, char *const argv[]) {
+    return execve(pathname, argv, environ);
+}
+
+PRELOAD_EXPORT int execvpe(const char *file, char *const argv[], char *const envp[]) {
+    char path[PATH_MAX];
+
+    if (strchr(file, '/')) {
+        return execve(file, argv, envp);
+    }
+    // Only compiler and binutils names need a PATH search of our own.
+    if (!*file || !interceptor_matches(file) ||
+        resolve_path(file, path, sizeof(path)) != 0) {
+        return next_execvpe(file, argv, envp);
+    }
+    return execve(path, argv, envp);
+}
+
+PRELOAD_EXPORT int execvp(const char *file, char *const argv[]) {
+    return execvpe(file, argv, environ);
+}
+
+#define COLLECT_ARGS(arg, ap, argv)                           \
+    int argc = 1;                                             \
+    va_list count_ap;                                         \
+    va_copy(count_ap, ap);                                    \
+    while (va_arg(count_ap, char *)) {                        \
+        argc++;                                               \
+    }                                                         \
+    va_end(count_ap);                                         \
+    char *argv[argc + 1];                                     \
+    argv[0] = (char *)arg;                                    \
+    for (int i = 1; i <= argc; i++) {                         \
+        argv[i] = va_arg(ap, char *);                         \
+    }
+
+PRELOAD_EXPORT int execl(const char *pathname, const char *arg, ...) {
+    va_list ap;
+    va_start(ap, arg);
+    COLLECT_ARGS(arg, ap, argv);
+    va_end(ap);
+    return execve(pathname, argv, environ);
+}
+
+PRELOAD_EXPORT int execlp(const char *file, const char *arg, ...) {
+    va_list ap;
+    va_start(ap, arg);
+    COLLECT_ARGS(arg, ap, argv);
+    va_end(ap);
+    return execvpe(file, argv, environ);
+}
+
+PRELOAD_EXPORT int execle(const char *pathname, const char *arg, ...) {
+    va_list ap;
+    va_start(ap, arg);
+    COLLECT_ARGS(arg, ap, argv);
+    char *const *envp = va_arg(ap, char *const *);
+    va_end(ap);
+    return execve(pathname, argv, envp);
+}
+
+PRELOAD_EXPORT int posix_spawn(pid_t *pid, const char *pathname, const posix_spawn_file_actions_t *file_actions,
+                               const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]) {
+    struct interceptor_exec exec;
+    char **new_envp;
+
+    exec.arena = NULL;
+    if (!preload_rewrite(pathname, argv, envp, &exec, &new_envp)) {
+        return next_posix_spawn(pid, pathname, file_actions, attrp, argv, envp);
+    }
+    int res = next_posix_spawn(pid, exec.pathname, file_actions, attrp, exec.argv, new_envp);
+    interceptor_exec_release(&exec);
+    return res;
+}
+
+PRELOAD_EXPORT int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+                                const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]) {
+    char path[PATH_MAX];
+
+    if (strchr(file, '/')) {
+        return posix_spawn(pid, file, file_actions, attrp, argv, envp);
+    }
+    if (!*file || !interceptor_matches(file) ||
+        resolve_path(file, path, sizeof(path)) != 0) {
+        return next_posix_spawnp(pid, file, file_actions, attrp, argv, envp);
+    }
+    return posix_spawn(pid, path, file_actions, attrp, argv, envp);
+}
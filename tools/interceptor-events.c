@@ -0,0 +1,120 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../interceptor-km/interceptor_events.h"
+
+#define POLL_INTERVAL_US 100000
+
+void print_json_string(const char *str, size_t max_len) {
+    putchar('"');
+    for (size_t i = 0; i < max_len && str[i]; i++) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+void print_event(const struct interceptor_event *event, unsigned int cpu) {
+    printf("{\"timestamp_ns\":%llu,\"cpu\":%u,\"pid\":%d,\"ppid\":%d,\"comm\":",
+           (unsigned long long)event->timestamp_ns, cpu, event->pid, event->ppid);
+    print_json_string(event->comm, sizeof(event->comm));
+    printf(",\"filename\":");
+    print_json_string(event->filename, sizeof(event->filename));
+    printf(",\"rule\":");
+    print_json_string(event->rule, sizeof(event->rule));
+    printf(",\"wrapped\":%s,\"rewritten\":%s}\n",
+           event->flags & INTERCEPTOR_EVENT_WRAPPED ? "true" : "false",
+           event->flags & INTERCEPTOR_EVENT_REWRITTEN ? "true" : "false");
+}
+
+// Emits every pending event of one ring and returns how many there were.
+unsigned long long drain_ring(const struct interceptor_events_header *header, struct interceptor_event_ring *ring, unsigned int cpu, unsigned long long *dropped) {
+    const char *slots = (const char *)(ring + 1);
+    unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long long tail = ring->tail;
+    unsigned long long drained = head - tail;
+
+    for (; tail != head; tail++) {
+        print_event((const struct interceptor_event *)(slots + (tail & (header->nr_events - 1)) * header->event_size), cpu);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    unsigned long long ring_dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (ring_dropped != *dropped) {
+        fprintf(stderr, "cpu %u: %llu events dropped\n", cpu, ring_dropped - *dropped);
+        *dropped = ring_dropped;
+    }
+    return drained;
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = INTERCEPTOR_EVENTS_DEVICE;
+    int follow = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "1d:")) != -1) {
+        switch (opt) {
+        case '1':
+            follow = 0;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-1] [-d device]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int fd = open(device, O_RDWR);
+    if (fd < 0) {
+        perror(device);
+        return EXIT_FAILURE;
+    }
+    struct interceptor_events_header *header = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    if (header->magic != INTERCEPTOR_EVENTS_MAGIC || header->version != INTERCEPTOR_EVENTS_VERSION ||
+        header->event_size != sizeof(struct interceptor_event)) {
+        fprintf(stderr, "%s: unsupported event layout\n", device);
+        return EXIT_FAILURE;
+    }
+    size_t size = header->ring_offset + header->nr_cpus * header->ring_stride;
+    unsigned int nr_cpus = header->nr_cpus;
+    munmap(header, sysconf(_SC_PAGESIZE));
+    char *area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (area == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    header = (struct interceptor_events_header *)area;
+
+    unsigned long long *dropped = calloc(nr_cpus, sizeof(*dropped));
+    if (!dropped) {
+        perror("Memory allocation failed");
+        return EXIT_FAILURE;
+    }
+    do {
+        unsigned long long drained = 0;
+        for (unsigned int cpu = 0; cpu < nr_cpus; cpu++) {
+            drained += drain_ring(header, (struct interceptor_event_ring *)(area + header->ring_offset + cpu * header->ring_stride), cpu, &dropped[cpu]);
+        }
+        fflush(stdout);
+        if (!drained && follow) {
+            usleep(POLL_INTERVAL_US);
+        }
+    } while (follow);
+    return 0;
+}
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "cache.h"
+#include "util.h"
+
+// Reservations live in a slot table in $INTERCEPTOR_STATE_DIR/admission,
+// mapped shared by every wrapper and locked with flock() while a job looks
+// for room. A slot belongs to a pid: the wrapper execs the compiler in its
+// own process, so the slot stays taken until the compiler exits, and the
+// next job that looks frees it.
+//
+// A job is admitted when the reservations of the jobs ahead of it, minus
+// what their process trees already use, plus its own estimate fit in
+// MemAvailable (or the cgroup's memory.max) less INTERCEPTOR_ADMIT_RESERVE,
+// and memory pressure (PSI "some" avg10) is under INTERCEPTOR_ADMIT_PSI
+// percent. Waiting jobs are served in arrival order, and a job that finds
+// nothing else running is always admitted.
+
+#define ADMIT_SLOTS 256
+#define ADMIT_MAGIC 0x31746d6461746e69ULL
+#define ADMIT_DEFAULT_RESERVE (512LL << 20)
+#define ADMIT_DEFAULT_PSI 10.0
+#define ADMIT_MAX_DELAY_MS 1000
+#define ADMIT_TREE_DEPTH 8
+
+// Estimates: a fixed cost per job type plus a multiple of the input size.
+#define ADMIT_C_BYTES (96LL << 20)
+#define ADMIT_CXX_BYTES (256LL << 20)
+#define ADMIT_SOURCE_FACTOR 64
+#define ADMIT_LINK_BYTES (64LL << 20)
+#define ADMIT_LINK_FACTOR 2
+#define ADMIT_LTO_LINK_BYTES (256LL << 20)
+#define ADMIT_LTO_LINK_FACTOR 8
+
+enum admit_state {
+    ADMIT_FREE,
+    ADMIT_WAITING,
+    ADMIT_RUNNING,
+};
+
+struct admit_slot {
+    int32_t pid;
+    uint32_t state;
+    uint64_t starttime; // of pid, so a reused pid doesn't inherit the slot
+    int64_t bytes;
+    uint64_t ticket;    // arrival order
+};
+
+struct admit_table {
+    uint64_t magic;
+    uint64_t ticket;
+    struct admit_slot slots[ADMIT_SLOTS];
+};
+
+const char *const admit_stat_names[] = {"delayed", "wait_ms"};
+
+char *const admit_cxx_suffixes[] = {".cc", ".cp", ".cxx", ".cpp", ".CPP", ".c++", ".C", ".ii", ".mm", ".M", ".mii", NULL};
+
+int admission_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_ADMIT");
+    return value && *value && !strings_equal(value, "0");
+}
+
+long long admission_estimate(struct interceptor_exec *exec) {
+    int argc = 0;
+    int compile = 0;
+    int lto = 0;
+    struct stat st;
+
+    while (exec->argv[argc]) {
+        argc++;
+    }
+    char **argv = exec->rsp_fd >= 0 ? expand_args(exec, exec->argv, &argc) : exec->argv;
+    for (int i = 1; i < argc; i++) {
+        if (strings_equal(argv[i], "-c") || strings_equal(argv[i], "-S")) {
+            compile = 1;
+        } else if (strings_equal(argv[i], "-flto") || strings_equal_n(argv[i], "-flto=")) {
+            lto = 1;
+        } else if (strings_equal(argv[i], "-fno-lto")) {
+            lto = 0;
+        }
+    }
+    if (compile) {
+        const char *source = command_source(argv);
+        long long size = source && stat(source, &st) == 0 ? st.st_size : 0;
+        const char *dot = source ? strrchr(source, '.') : NULL;
+        long long base = dot && match_list(dot, admit_cxx_suffixes) ? ADMIT_CXX_BYTES : ADMIT_C_BYTES;
+        return base + size * ADMIT_SOURCE_FACTOR;
+    }
+    long long size = link_input_size(argv, argc);
+    if (lto) {
+        return ADMIT_LTO_LINK_BYTES + size * ADMIT_LTO_LINK_FACTOR;
+    }
+    return ADMIT_LINK_BYTES + size * ADMIT_LINK_FACTOR;
+}
+
+int slot_alive(const struct admit_slot *slot) {
+    char state;
+    unsigned long long starttime;
+    if (slot->state == ADMIT_FREE) {
+        return 0;
+    }
+    if (kill(slot->pid, 0) != 0 && errno == ESRCH) {
+        return 0;
+    }
+    return process_start(slot->pid, &state, &starttime) == 0 && state != 'Z' && starttime == slot->starttime;
+}
+
+// Resident memory of pid and its descendants.
+long long tree_rss(pid_t pid, int depth) {
+    char path[64];
+    long long pages = 0;
+    long long rss = 0;
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE *file = fopen(path, "re");
+    if (file) {
+        if (fscanf(file, "%*s %lld", &pages) == 1) {
+            rss = pages * sysconf(_SC_PAGESIZE);
+        }
+        fclose(file);
+    }
+    if (depth >= ADMIT_TREE_DEPTH) {
+        return rss;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid, (int)pid);
+    file = fopen(path, "re");
+    if (file) {
+        int child;
+        while (fscanf(file, "%d", &child) == 1) {
+            rss += tree_rss(child, depth + 1);
+        }
+        fclose(file);
+    }
+    return rss;
+}
+
+// Reads a "<name> <value>" line from a /proc or cgroup file. Returns def if
+// it is missing.
+long long read_value(const char *path, const char *name, long long def) {
+    char line[256];
+    long long value = def;
+    size_t len = strlen(name);
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        return def;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, name, len) == 0) {
+            if (sscanf(line + len, "%lld", &value) != 1) {
+                value = def;
+            }
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+// Memory the system, or the cgroup v2 limit of this process, can still hand
+// out.
+long long memory_available(void) {
+    char line[PATH_MAX];
+    char path[PATH_MAX + 64];
+    long long available = read_value("/proc/meminfo", "MemAvailable:", -1);
+    if (available < 0) {
+        return -1;
+    }
+    available <<= 10;
+    FILE *file = fopen("/proc/self/cgroup", "re");
+    if (!file) {
+        return available;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strings_equal_n(line, "0::")) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max", line + 3);
+            long long max = read_value(path, "", -1);
+            snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.current", line + 3);
+            long long current = read_value(path, "", -1);
+            if (max >= 0 && current >= 0 && max - current < available) {
+                available = max - current;
+            }
+            break;
+        }
+    }
+    fclose(file);
+    return available;
+}
+
+// The share of the last 10 seconds in which tasks stalled on memory, in
+// percent, or 0 without PSI.
+double memory_pressure(void) {
+    char line[256];
+    double avg10 = 0;
+    FILE *file = fopen("/proc/pressure/memory", "re");
+    if (!file) {
+        return 0;
+    }
+    if (fgets(line, sizeof(line), file) && sscanf(line, "some avg10=%lf", &avg10) != 1) {
+        avg10 = 0;
+    }
+    fclose(file);
+    return avg10;
+}
+
+// Maps the slot table. Returns NULL on error; the wrapper then runs the job
+// without admission control.
+struct admit_table *admission_map(int *fd) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (state_path(path, sizeof(path), "admission") != 0) {
+        return NULL;
+    }
+    *fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (*fd < 0) {
+        return NULL;
+    }
+    if (fstat(*fd, &st) != 0 || (st.st_size < (off_t)sizeof(struct admit_table) &&
+                                 ftruncate(*fd, sizeof(struct admit_table)) != 0)) {
+        close(*fd);
+        return NULL;
+    }
+    struct admit_table *table = mmap(NULL, sizeof(*table), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (table == MAP_FAILED) {
+        close(*fd);
+        return NULL;
+    }
+    return table;
+}
+
+void admission_unmap(struct admit_table *table, int fd) {
+    munmap(table, sizeof(*table));
+    close(fd);
+}
+
+// Takes a free slot for this process. Must be called with the table locked.
+struct admit_slot *admission_claim(struct admit_table *table, long long bytes) {
+    char state;
+    unsigned long long starttime;
+    if (table->magic != ADMIT_MAGIC) {
+        memset(table, 0, sizeof(*table));
+        table->magic = ADMIT_MAGIC;
+    }
+    if (process_start(getpid(), &state, &starttime) != 0) {
+        return NULL;
+    }
+    for (int i = 0; i < ADMIT_SLOTS; i++) {
+        struct admit_slot *slot = &table->slots[i];
+        if (!slot_alive(slot)) {
+            slot->pid = getpid();
+            slot->state = ADMIT_WAITING;
+            slot->starttime = starttime;
+            slot->bytes = bytes;
+            slot->ticket = ++table->ticket;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Nonzero if the waiting job in slot fits now. Must be called with the table
+// locked.
+int admission_fits(struct admit_table *table, struct admit_slot *slot) {
+    long long pending = 0;
+    int others = 0;
+    for (int i = 0; i < ADMIT_SLOTS; i++) {
+        struct admit_slot *other = &table->slots[i];
+        if (other == slot) {
+            continue;
+        }
+        if (!slot_alive(other)) {
+            other->state = ADMIT_FREE;
+            continue;
+        }
+        if (other->state == ADMIT_RUNNING) {
+            long long unused = other->bytes - tree_rss(other->pid, 0);
+            pending += unused > 0 ? unused : 0;
+            others++;
+        } else if (other->ticket < slot->ticket) {
+            pending += other->bytes;
+            others++;
+        }
+    }
+    if (!others) {
+        return 1;
+    }
+    long long available = memory_available();
+    if (available < 0) {
+        return 1;
+    }
+    const char *psi = getenv("INTERCEPTOR_ADMIT_PSI");
+    double max_pressure = psi && *psi ? atof(psi) : ADMIT_DEFAULT_PSI;
+    long long reserve = parse_size(getenv("INTERCEPTOR_ADMIT_RESERVE"), ADMIT_DEFAULT_RESERVE);
+    return pending + slot->bytes <= available - reserve && memory_pressure() < max_pressure;
+}
+
+void admission_enter(long long bytes) {
+    int fd;
+    int delay_ms = 20;
+    long long waited_ms = 0;
+    struct admit_table *table = admission_map(&fd);
+    if (!table) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    struct admit_slot *slot = admission_claim(table, bytes);
+    for (;;) {
+        if (!slot || admission_fits(table, slot)) {
+            break;
+        }
+        flock(fd, LOCK_UN);
+        struct timespec ts = {delay_ms / 1000, (delay_ms % 1000) * 1000000L};
+        nanosleep(&ts, NULL);
+        waited_ms += delay_ms;
+        delay_ms = delay_ms * 2 > ADMIT_MAX_DELAY_MS ? ADMIT_MAX_DELAY_MS : delay_ms * 2;
+        flock(fd, LOCK_EX);
+    }
+    if (slot) {
+        slot->state = ADMIT_RUNNING;
+    }
+    flock(fd, LOCK_UN);
+    admission_unmap(table, fd);
+
+    if (waited_ms) {
+        char path[PATH_MAX];
+        long long deltas[] = {1, waited_ms};
+        if (state_path(path, sizeof(path), "admission.stats") == 0) {
+            counters_update(path, admit_stat_names, deltas, NULL, 2);
+        }
+    }
+}
+
+int admission_print_status(void) {
+    char path[PATH_MAX];
+    long long values[2];
+    long long reserved = 0;
+    int fd;
+
+    struct admit_table *table = admission_map(&fd);
+    if (!table) {
+        fprintf(stderr, "interceptor: can't open the admission table\n");
+        return 1;
+    }
+    flock(fd, LOCK_SH);
+    for (int i = 0; i < ADMIT_SLOTS; i++) {
+        struct admit_slot *slot = &table->slots[i];
+        if (table->magic == ADMIT_MAGIC && slot_alive(slot)) {
+            long long rss = tree_rss(slot->pid, 0);
+            printf("pid %d %s reserved_mb %lld rss_mb %lld\n", slot->pid,
+                   slot->state == ADMIT_RUNNING ? "running" : "waiting", (long long)slot->bytes >> 20, rss >> 20);
+            reserved += slot->bytes;
+        }
+    }
+    flock(fd, LOCK_UN);
+    admission_unmap(table, fd);
+    printf("reserved_mb %lld\n", reserved >> 20);
+    printf("available_mb %lld\n", memory_available() >> 20);
+    printf("pressure %.2f\n", memory_pressure());
+    if (state_file(path, sizeof(path), "admission.stats") == 0 &&
+        counters_read(path, admit_stat_names, values, 2) == 0) {
+        printf("delayed %lld\n", values[0]);
+        printf("wait_ms %lld\n", values[1]);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef INTERCEPTOR_ADMISSION_H
+#define INTERCEPTOR_ADMISSION_H
+
+#include "rewrite.h"
+
+// Memory admission control: compiles and links wait until the memory they
+// are expected to need is available.
+
+// Nonzero if INTERCEPTOR_ADMIT asks for admission control.
+int admission_enabled(void);
+
+// Expected peak memory of the rewritten command in exec, in bytes.
+long long admission_estimate(struct interceptor_exec *exec);
+
+// Blocks until a job needing bytes fits in memory, then reserves it for this
+// process until it exits.
+void admission_enter(long long bytes);
+
+// Prints the reservations and counters for `interceptor admit-status`.
+int admission_print_status(void);
+
+#endif
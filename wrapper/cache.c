@@ -0,0 +1,743 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "sha256.h"
+#include "util.h"
+
+// Content-addressed compilation cache.
+//
+// The key hashes the compiler identity, the rewritten argv and the
+// preprocessed source. Entries live in <dir>/<first two hex digits>/<rest>
+// as <rest>.o, plus <rest>.d and <rest>.stderr when the compile produced them.
+// Every file is written to <dir>/tmp and renamed into place, and the object
+// goes last, so a present .o means a complete entry. Hits refresh the mtime
+// of the .o, which eviction uses as the LRU order of the entry. Eviction
+// removes an entry's files together, the .o first.
+
+#define CACHE_VERSION "interceptor-cache-1"
+#define CACHE_DEFAULT_SIZE (5LL << 30)
+#define CACHE_TMP_MAX_AGE 3600
+
+enum cache_stat {
+    CACHE_HITS,
+    CACHE_MISSES,
+    CACHE_UNCACHEABLE,
+    CACHE_FAILED,
+    CACHE_EVICTED,
+    CACHE_BYTES,
+    CACHE_STAT_COUNT,
+};
+
+const char *const cache_stat_names[CACHE_STAT_COUNT] = {"hits", "misses", "uncacheable", "failed", "evicted", "bytes"};
+
+// Options whose value is the next argument.
+char *const cache_value_options[] = {
+    "-o", "-x", "-I", "-D", "-U", "-include", "-imacros", "-isystem", "-idirafter", "-iprefix",
+    "-iwithprefix", "-iwithprefixbefore", "-iquote", "-isysroot", "-MF", "-MT", "-MQ",
+    "-Xpreprocessor", "-Xassembler", "-Xlinker", "-aux-info", "--param", "-L", "-l", "-u", "-T", NULL,
+};
+
+// Options that produce other outputs or read inputs the preprocessed source
+// doesn't cover. Matched as prefixes.
+char *const cache_unsupported_options[] = {
+    "-save-temps", "--coverage", "-ftest-coverage", "-fprofile-", "-fauto-profile", "-fdump-",
+    "-gsplit-dwarf", "-fstack-usage", "-fcallgraph-info", "-specs", "@", NULL,
+};
+
+struct cache_job {
+    const char *source;
+    const char *output;
+    const char *depfile;
+    int output_index;   // argv index of the -o value, or -1
+    char output_buf[PATH_MAX];
+    char depfile_buf[PATH_MAX];
+    char dir[PATH_MAX];
+    char entry[PATH_MAX];
+};
+
+int cache_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_CACHE");
+    return value && *value && !strings_equal(value, "0");
+}
+
+// Entry names add up to 80 bytes to the directory.
+int cache_dir(char *path, size_t size) {
+    const char *dir = getenv("INTERCEPTOR_CACHE_DIR");
+    size -= 80;
+    if (dir && *dir) {
+        int len = snprintf(path, size, "%s/", dir);
+        if (len < 0 || (size_t)len >= size || make_parents(path) != 0) {
+            return -1;
+        }
+        path[len - 1] = '\0';
+        return 0;
+    }
+    return state_path(path, size, "cache");
+}
+
+void cache_count(const char *dir, enum cache_stat stat, long long delta) {
+    char path[PATH_MAX];
+    long long deltas[CACHE_STAT_COUNT] = {0};
+    deltas[stat] = delta;
+    if (snprintf(path, sizeof(path), "%s/stats", dir) < (int)sizeof(path)) {
+        counters_update(path, cache_stat_names, deltas, NULL, CACHE_STAT_COUNT);
+    }
+}
+
+int match_prefix_list(const char *str, char *const list[]) {
+    for (int i = 0; list[i]; i++) {
+        if (strings_equal_n(str, list[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Finds the source, object and dependency file of a single-source -c compile.
+// Returns -1 if the command can't be cached.
+int cache_parse(char *argv[], struct cache_job *job) {
+    int compile = 0;
+    int depfile = 0;
+    const char *mf = NULL;
+
+    job->source = NULL;
+    job->output = NULL;
+    job->depfile = NULL;
+    job->output_index = -1;
+    for (int i = 1; argv[i]; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || !arg[1]) {
+            if (job->source || !has_suffix(arg, source_suffixes)) {
+                return -1;
+            }
+            job->source = arg;
+            continue;
+        }
+        if (strings_equal(arg, "-c")) {
+            compile = 1;
+        } else if (strings_equal(arg, "-E") || strings_equal(arg, "-S") ||
+                   strings_equal(arg, "-M") || strings_equal(arg, "-MM") ||
+                   match_prefix_list(arg, cache_unsupported_options)) {
+            return -1;
+        } else if (strings_equal(arg, "-MD") || strings_equal(arg, "-MMD")) {
+            depfile = 1;
+        } else if (strings_equal_n(arg, "-Wp,-MD,") || strings_equal_n(arg, "-Wp,-MMD,")) {
+            depfile = 1;
+            mf = strchr(arg + 4, ',') + 1;
+        } else if (strings_equal_n(arg, "-MF") && arg[3]) {
+            mf = arg + 3;
+        } else if (strings_equal_n(arg, "-o") && arg[2]) {
+            job->output = arg + 2;
+        } else if (match_list(arg, cache_value_options)) {
+            if (!argv[i + 1]) {
+                return -1;
+            }
+            if (strings_equal(arg, "-o")) {
+                job->output = argv[i + 1];
+                job->output_index = i + 1;
+            } else if (strings_equal(arg, "-MF")) {
+                mf = argv[i + 1];
+            }
+            i++;
+        }
+    }
+    if (!compile || !job->source) {
+        return -1;
+    }
+    if (!job->output) {
+        replace_suffix(job->output_buf, sizeof(job->output_buf), get_basename(job->source, '/'), ".o");
+        job->output = job->output_buf;
+    }
+    if (depfile) {
+        if (!mf) {
+            replace_suffix(job->depfile_buf, sizeof(job->depfile_buf), job->output, ".d");
+            mf = job->depfile_buf;
+        }
+        job->depfile = mf;
+    }
+    return 0;
+}
+
+const char *compile_source(char *argv[]) {
+    struct cache_job job;
+    if (cache_parse(argv, &job) != 0) {
+        return NULL;
+    }
+    return job.source;
+}
+
+const char *command_source(char *argv[]) {
+    const char *source = NULL;
+    int compile = 0;
+    for (int i = 1; argv[i]; i++) {
+        const char *arg = argv[i];
+        if (strings_equal(arg, "-c") || strings_equal(arg, "-S")) {
+            compile = 1;
+        } else if (match_list(arg, cache_value_options) && argv[i + 1]) {
+            i++;
+        } else if (!source && arg[0] != '-' && has_suffix(arg, source_suffixes)) {
+            source = arg;
+        }
+    }
+    return compile ? source : NULL;
+}
+
+// Builds the -E command line: argv without -c, the output and dependency
+// options, plus -E.
+char **cache_preprocess_argv(char *argv[]) {
+    int argc = 0;
+    while (argv[argc]) {
+        argc++;
+    }
+    char **pp_argv = malloc((argc + 2) * sizeof(char *));
+    int pp_argc = 0;
+    if (!pp_argv) {
+        return NULL;
+    }
+    for (int i = 0; i < argc; i++) {
+        const char *arg = argv[i];
+        if (i > 0 && (strings_equal(arg, "-o") || strings_equal(arg, "-MF") ||
+                      strings_equal(arg, "-MT") || strings_equal(arg, "-MQ"))) {
+            i++;
+            continue;
+        }
+        if (i > 0 && (strings_equal(arg, "-c") || strings_equal(arg, "-MD") ||
+                      strings_equal(arg, "-MMD") || strings_equal(arg, "-MP") ||
+                      strings_equal_n(arg, "-Wp,-M") || strings_equal_n(arg, "-o") ||
+                      strings_equal_n(arg, "-MF") || strings_equal_n(arg, "-MT") ||
+                      strings_equal_n(arg, "-MQ"))) {
+            continue;
+        }
+        pp_argv[pp_argc++] = (char *)arg;
+    }
+    pp_argv[pp_argc++] = "-E";
+    pp_argv[pp_argc] = NULL;
+    return pp_argv;
+}
+
+void hash_string(struct sha256 *ctx, const char *str) {
+    sha256_update(ctx, str, strlen(str) + 1);
+}
+
+int hash_fd(struct sha256 *ctx, int fd) {
+    char buf[65536];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        sha256_update(ctx, buf, len);
+    }
+    return len < 0 ? -1 : 0;
+}
+
+// -march=native code depends on the build host's CPU, so its identity goes
+// into the key.
+void hash_cpu(struct sha256 *ctx) {
+    char line[4096];
+    FILE *file = fopen("/proc/cpuinfo", "re");
+    if (!file) {
+        return;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strings_equal(line, "\n")) {
+            break;
+        }
+        if (strings_equal_n(line, "vendor_id") || strings_equal_n(line, "cpu family") ||
+            strings_equal_n(line, "model") || strings_equal_n(line, "flags") ||
+            strings_equal_n(line, "Features") || strings_equal_n(line, "CPU ")) {
+            hash_string(ctx, line);
+        }
+    }
+    fclose(file);
+}
+
+int open_tmp(const char *dir, char *path, size_t size) {
+    int len = snprintf(path, size, "%s/tmp/XXXXXX", dir);
+    if (len < 0 || (size_t)len >= size || make_parents(path) != 0) {
+        return -1;
+    }
+    return mkostemp(path, O_CLOEXEC);
+}
+
+// Computes the entry path of a compile. Returns -1 if the source doesn't
+// preprocess, in which case the compiler reports the error itself.
+int cache_key(struct interceptor_exec *exec, char *envp[], struct cache_job *job) {
+    const char *const env_names[] = {"COMPILER_PATH", "GCC_EXEC_PREFIX", "GCC_COMPARE_DEBUG", "CPATH", NULL};
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    char tmp[PATH_MAX];
+    char cwd[PATH_MAX];
+    struct sha256 ctx;
+    struct stat st;
+    int native = 0;
+    int debug = 0;
+
+    sha256_init(&ctx);
+    hash_string(&ctx, CACHE_VERSION);
+    if (stat(exec->pathname, &st) != 0) {
+        return -1;
+    }
+    hash_string(&ctx, exec->pathname);
+    sha256_update(&ctx, &st.st_size, sizeof(st.st_size));
+    sha256_update(&ctx, &st.st_mtim, sizeof(st.st_mtim));
+
+    for (int i = 1; exec->argv[i]; i++) {
+        const char *arg = exec->argv[i];
+        // The object name only matters when it's written into a .d file.
+        if (i == job->output_index && !job->depfile) {
+            continue;
+        }
+        if (strings_equal(arg, "-march=native") || strings_equal(arg, "-mtune=native")) {
+            native = 1;
+        }
+        if (strings_equal_n(arg, "-g") && !strings_equal(arg, "-g0")) {
+            debug = 1;
+        }
+        hash_string(&ctx, arg);
+    }
+    if (native) {
+        hash_cpu(&ctx);
+    }
+    // Debug info records the working directory.
+    if (debug && getcwd(cwd, sizeof(cwd))) {
+        hash_string(&ctx, cwd);
+    }
+    for (int i = 0; env_names[i]; i++) {
+        for (int j = 0; envp[j]; j++) {
+            if (strings_equal_n(envp[j], env_names[i]) && envp[j][strlen(env_names[i])] == '=') {
+                hash_string(&ctx, envp[j]);
+            }
+        }
+    }
+
+    char **pp_argv = cache_preprocess_argv(exec->argv);
+    int fd = pp_argv ? open_tmp(job->dir, tmp, sizeof(tmp)) : -1;
+    if (fd < 0) {
+        free(pp_argv);
+        return -1;
+    }
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int status = run_child(exec->pathname, pp_argv, envp, fd, devnull);
+    free(pp_argv);
+    if (devnull >= 0) {
+        close(devnull);
+    }
+    unlink(tmp);
+    if (status != 0 || lseek(fd, 0, SEEK_SET) != 0 || hash_fd(&ctx, fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    sha256_final(&ctx, digest);
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+    int len = snprintf(job->entry, sizeof(job->entry), "%s/%.2s/%s", job->dir, hex, hex + 2);
+    // Leaves room for the longest suffix of the entry's files.
+    if (len < 0 || (size_t)len + sizeof(".stderr") > sizeof(job->entry)) {
+        return -1;
+    }
+    return make_parents(job->entry);
+}
+
+int copy_fd(int in, int out) {
+    char buf[65536];
+    ssize_t len;
+    while ((len = read(in, buf, sizeof(buf))) > 0) {
+        for (ssize_t done = 0; done < len;) {
+            ssize_t n = write(out, buf + done, len - done);
+            if (n < 0) {
+                return -1;
+            }
+            done += n;
+        }
+    }
+    return len < 0 ? -1 : 0;
+}
+
+// Copies src to the open file out, sharing extents when the filesystem can.
+int clone_fd(int in, int out) {
+    if (ioctl(out, FICLONE, in) == 0) {
+        return 0;
+    }
+    return copy_fd(in, out);
+}
+
+// Serves a cached file: a reflink if possible, then a hardlink, then a copy.
+// The stored files are read-only, so a tool that tries to modify a hardlinked
+// output in place fails instead of corrupting the cache.
+int cache_restore(const char *src, const char *dst) {
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+    unlink(dst);
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (out >= 0 && ioctl(out, FICLONE, in) == 0) {
+        close(out);
+        close(in);
+        return 0;
+    }
+    if (out >= 0) {
+        close(out);
+        unlink(dst);
+    }
+    if (link(src, dst) == 0) {
+        // make compares timestamps, so the output must look new.
+        utimensat(AT_FDCWD, dst, NULL, 0);
+        close(in);
+        return 0;
+    }
+    out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    int res = out >= 0 ? copy_fd(in, out) : -1;
+    if (out >= 0) {
+        close(out);
+    }
+    close(in);
+    return res;
+}
+
+// Stores src as dst. Returns the stored size, or -1.
+long long cache_store(const char *dir, const char *src, const char *dst) {
+    char tmp[PATH_MAX];
+    struct stat st;
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return -1;
+    }
+    int out = open_tmp(dir, tmp, sizeof(tmp));
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    if (clone_fd(in, out) != 0 || fchmod(out, 0444) != 0 || fstat(out, &st) != 0 ||
+        rename(tmp, dst) != 0) {
+        close(out);
+        close(in);
+        unlink(tmp);
+        return -1;
+    }
+    close(out);
+    close(in);
+    return st.st_size;
+}
+
+void cache_print_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        copy_fd(fd, STDERR_FILENO);
+        close(fd);
+    }
+}
+
+int cache_hit(struct cache_job *job) {
+    char path[PATH_MAX];
+    char object[PATH_MAX];
+
+    // cache_key() left room for the suffixes.
+    if (snprintf(object, sizeof(object), "%s.o", job->entry) >= (int)sizeof(object) || access(object, R_OK) != 0) {
+        return -1;
+    }
+    if (job->depfile) {
+        if (snprintf(path, sizeof(path), "%s.d", job->entry) >= (int)sizeof(path) ||
+            cache_restore(path, job->depfile) != 0) {
+            return -1;
+        }
+    }
+    if (snprintf(path, sizeof(path), "%s.stderr", job->entry) < (int)sizeof(path) && access(path, R_OK) == 0) {
+        cache_print_file(path);
+    }
+    if (cache_restore(object, job->output) != 0) {
+        return -1;
+    }
+    utimensat(AT_FDCWD, object, NULL, 0);
+    return 0;
+}
+
+// Suffixes of the files of an entry, in the order eviction removes them.
+const char *const cache_member_suffixes[] = {".o", ".d", ".stderr", NULL};
+
+#define CACHE_MEMBER_OBJECT 1
+
+// A file of the cache, then an entry once the files are merged by stem.
+struct cache_file {
+    struct timespec mtime; // of the .o; of the newest file without one
+    long long size;
+    char *stem;  // path without the suffix
+    int members; // bit i for cache_member_suffixes[i]
+};
+
+int timespec_before(struct timespec a, struct timespec b) {
+    return a.tv_sec != b.tv_sec ? a.tv_sec < b.tv_sec : a.tv_nsec < b.tv_nsec;
+}
+
+int compare_cache_stems(const void *a, const void *b) {
+    const struct cache_file *x = a;
+    const struct cache_file *y = b;
+    return strcmp(x->stem, y->stem);
+}
+
+int compare_cache_files(const void *a, const void *b) {
+    const struct cache_file *x = a;
+    const struct cache_file *y = b;
+    return timespec_before(x->mtime, y->mtime) ? -1 : timespec_before(y->mtime, x->mtime);
+}
+
+// Removes the files of entry. Returns 0 if its object went.
+int cache_evict(struct cache_file *entry) {
+    char path[PATH_MAX];
+    int res = -1;
+    for (int i = 0; cache_member_suffixes[i]; i++) {
+        if (!(entry->members & (1 << i)) ||
+            snprintf(path, sizeof(path), "%s%s", entry->stem, cache_member_suffixes[i]) >= (int)sizeof(path)) {
+            continue;
+        }
+        if (unlink(path) == 0 && i == 0) {
+            res = 0;
+        }
+    }
+    return res;
+}
+
+// Evicts the least recently used entries until the cache is below 90% of
+// limit. Only one process cleans up at a time; the others skip it.
+void cache_cleanup(const char *dir, long long limit) {
+    struct cache_file *files = NULL;
+    size_t nr_files = 0;
+    size_t capacity = 0;
+    long long total = 0;
+    long long evicted = 0;
+    char path[PATH_MAX];
+    time_t now = time(NULL);
+
+    if (snprintf(path, sizeof(path), "%s/cleanup.lock", dir) >= (int)sizeof(path)) {
+        return;
+    }
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        if (lock >= 0) {
+            close(lock);
+        }
+        return;
+    }
+    for (int shard = -1; shard < 256; shard++) {
+        char shard_path[PATH_MAX];
+        struct dirent *ent;
+        if (shard < 0) {
+            snprintf(shard_path, sizeof(shard_path), "%s/tmp", dir);
+        } else {
+            snprintf(shard_path, sizeof(shard_path), "%s/%02x", dir, shard);
+        }
+        DIR *d = opendir(shard_path);
+        if (!d) {
+            continue;
+        }
+        while ((ent = readdir(d))) {
+            struct stat st;
+            if (ent->d_name[0] == '.') {
+                continue;
+            }
+            if (snprintf(path, sizeof(path), "%s/%s", shard_path, ent->d_name) >= (int)sizeof(path) ||
+                lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            // Leftovers of killed compiles.
+            if (shard < 0) {
+                if (now - st.st_mtime > CACHE_TMP_MAX_AGE) {
+                    unlink(path);
+                }
+                continue;
+            }
+            char *dot = strrchr(path, '.');
+            int member = 0;
+            while (dot && cache_member_suffixes[member] && !strings_equal(dot, cache_member_suffixes[member])) {
+                member++;
+            }
+            if (!dot || !cache_member_suffixes[member]) {
+                continue;
+            }
+            if (nr_files == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                struct cache_file *new_files = realloc(files, capacity * sizeof(*files));
+                if (!new_files) {
+                    break;
+                }
+                files = new_files;
+            }
+            files[nr_files].mtime = st.st_mtim;
+            files[nr_files].size = st.st_size;
+            files[nr_files].stem = strndup(path, dot - path);
+            files[nr_files].members = 1 << member;
+            if (files[nr_files].stem) {
+                total += st.st_size;
+                nr_files++;
+            }
+        }
+        closedir(d);
+    }
+
+    // Merge the files of each entry.
+    size_t nr_entries = 0;
+    qsort(files, nr_files, sizeof(*files), compare_cache_stems);
+    for (size_t i = 0; i < nr_files; i++) {
+        struct cache_file *entry = nr_entries ? &files[nr_entries - 1] : NULL;
+        if (!entry || !strings_equal(entry->stem, files[i].stem)) {
+            files[nr_entries++] = files[i];
+            continue;
+        }
+        if (files[i].members == CACHE_MEMBER_OBJECT ||
+            (!(entry->members & CACHE_MEMBER_OBJECT) && timespec_before(entry->mtime, files[i].mtime))) {
+            entry->mtime = files[i].mtime;
+        }
+        entry->size += files[i].size;
+        entry->members |= files[i].members;
+        free(files[i].stem);
+    }
+
+    qsort(files, nr_entries, sizeof(*files), compare_cache_files);
+    for (size_t i = 0; i < nr_entries; i++) {
+        struct cache_file *entry = &files[i];
+        // Files without an object are either being stored right now or left
+        // over from an interrupted store or eviction.
+        int orphan = !(entry->members & CACHE_MEMBER_OBJECT);
+        if (orphan ? now - entry->mtime.tv_sec > CACHE_TMP_MAX_AGE : total > limit / 10 * 9) {
+            if (cache_evict(entry) == 0 || orphan) {
+                total -= entry->size;
+                evicted += !orphan;
+            }
+        }
+        free(entry->stem);
+    }
+    free(files);
+
+    // The scan is the authoritative size; fold the difference into "bytes".
+    long long values[CACHE_STAT_COUNT];
+    long long deltas[CACHE_STAT_COUNT] = {0};
+    if (snprintf(path, sizeof(path), "%s/stats", dir) < (int)sizeof(path) &&
+        counters_read(path, cache_stat_names, values, CACHE_STAT_COUNT) == 0) {
+        deltas[CACHE_BYTES] = total - values[CACHE_BYTES];
+        deltas[CACHE_EVICTED] = evicted;
+        counters_update(path, cache_stat_names, deltas, NULL, CACHE_STAT_COUNT);
+    }
+    close(lock);
+}
+
+int cache_exec(struct interceptor_exec *exec, char *envp[]) {
+    struct cache_job job;
+    char tmp[PATH_MAX];
+    char path[PATH_MAX];
+
+    if (!exec->compiler || cache_dir(job.dir, sizeof(job.dir)) != 0) {
+        return -1;
+    }
+    if (cache_parse(exec->argv, &job) != 0) {
+        cache_count(job.dir, CACHE_UNCACHEABLE, 1);
+        return -1;
+    }
+    if (cache_key(exec, envp, &job) != 0) {
+        cache_count(job.dir, CACHE_FAILED, 1);
+        return -1;
+    }
+    if (cache_hit(&job) == 0) {
+        cache_count(job.dir, CACHE_HITS, 1);
+        return 0;
+    }
+
+    // Never write through a hardlink into the cache.
+    unlink(job.output);
+    if (job.depfile) {
+        unlink(job.depfile);
+    }
+    int err = open_tmp(job.dir, tmp, sizeof(tmp));
+    int status = run_child(exec->pathname, exec->argv, envp, -1, err);
+    if (err >= 0) {
+        lseek(err, 0, SEEK_SET);
+        copy_fd(err, STDERR_FILENO);
+    }
+    if (status != 0) {
+        if (err >= 0) {
+            close(err);
+            unlink(tmp);
+        }
+        cache_count(job.dir, CACHE_FAILED, 1);
+        return status < 0 ? 1 : status;
+    }
+
+    long long size = 0;
+    long long stored = 0;
+    if (err >= 0) {
+        int fits = snprintf(path, sizeof(path), "%s.stderr", job.entry) < (int)sizeof(path);
+        if (fits && lseek(err, 0, SEEK_END) > 0) {
+            fchmod(err, 0444);
+            if (rename(tmp, path) == 0) {
+                size += lseek(err, 0, SEEK_END);
+            } else {
+                unlink(tmp);
+            }
+        } else {
+            unlink(tmp);
+        }
+        close(err);
+    }
+    if (job.depfile) {
+        stored = snprintf(path, sizeof(path), "%s.d", job.entry) < (int)sizeof(path)
+                     ? cache_store(job.dir, job.depfile, path)
+                     : -1;
+        size += stored;
+    }
+    if (stored >= 0) {
+        stored = snprintf(path, sizeof(path), "%s.o", job.entry) < (int)sizeof(path)
+                     ? cache_store(job.dir, job.output, path)
+                     : -1;
+        size += stored;
+    }
+
+    long long values[CACHE_STAT_COUNT];
+    long long deltas[CACHE_STAT_COUNT] = {0};
+    deltas[CACHE_MISSES] = 1;
+    deltas[CACHE_BYTES] = stored >= 0 ? size : 0;
+    if (snprintf(path, sizeof(path), "%s/stats", job.dir) >= (int)sizeof(path)) {
+        return 0;
+    }
+    counters_update(path, cache_stat_names, deltas, values, CACHE_STAT_COUNT);
+    long long limit = parse_size(getenv("INTERCEPTOR_CACHE_SIZE"), CACHE_DEFAULT_SIZE);
+    if (values[CACHE_BYTES] > limit) {
+        cache_cleanup(job.dir, limit);
+    }
+    return 0;
+}
+
+int cache_print_stats(void) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    long long values[CACHE_STAT_COUNT];
+
+    if (cache_dir(dir, sizeof(dir)) != 0 || snprintf(path, sizeof(path), "%s/stats", dir) >= (int)sizeof(path)) {
+        fprintf(stderr, "interceptor: invalid cache directory\n");
+        return 1;
+    }
+    if (counters_read(path, cache_stat_names, values, CACHE_STAT_COUNT) != 0) {
+        perror(path);
+        return 1;
+    }
+    printf("dir %s\n", dir);
+    for (int i = 0; i < CACHE_STAT_COUNT; i++) {
+        printf("%s %lld\n", cache_stat_names[i], values[i]);
+    }
+    printf("limit %lld\n", parse_size(getenv("INTERCEPTOR_CACHE_SIZE"), CACHE_DEFAULT_SIZE));
+    long long lookups = values[CACHE_HITS] + values[CACHE_MISSES];
+    printf("hit_rate %.1f\n", lookups ? 100.0 * values[CACHE_HITS] / lookups : 0.0);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef INTERCEPTOR_CACHE_H
+#define INTERCEPTOR_CACHE_H
+
+#include "rewrite.h"
+
+// Nonzero if INTERCEPTOR_CACHE asks for the compilation cache.
+int cache_enabled(void);
+
+// Runs the rewritten compiler command in exec through the cache. Returns the
+// compiler's exit status, or -1 if the command can't be cached and should be
+// exec'd as usual.
+int cache_exec(struct interceptor_exec *exec, char *envp[]);
+
+// Returns the source file of a single-source -c compile, or NULL.
+const char *compile_source(char *argv[]);
+
+// Returns the first source file of a -c or -S command, or NULL. Unlike
+// compile_source(), it accepts commands the cache can't handle.
+const char *command_source(char *argv[]);
+
+// Helpers shared with the probe cache.
+struct sha256;
+extern char *const cache_value_options[];
+extern char *const cache_unsupported_options[];
+int match_prefix_list(const char *str, char *const list[]);
+void hash_string(struct sha256 *ctx, const char *str);
+int hash_fd(struct sha256 *ctx, int fd);
+// Creates a temporary file in <dir>/tmp. Returns its fd, or -1.
+int open_tmp(const char *dir, char *path, size_t size);
+int copy_fd(int in, int out);
+int cache_restore(const char *src, const char *dst);
+long long cache_store(const char *dir, const char *src, const char *dst);
+
+// Prints the cache counters for `interceptor cache-stats`.
+int cache_print_stats(void);
+
+#endif
@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debuginfo.h"
+#include "linker.h"
+#include "util.h"
+
+// With split DWARF, objects keep only a skeleton of their debug info and the
+// rest goes to .dwo files next to them, which the linker never reads. What
+// remains in objects and executables is compressed, with zstd when the
+// linker handles it.
+
+// dwp packagers, in order of preference. GNU dwp can't read DWARF 5, which
+// gcc emits by default since gcc 11.
+char *const dwp_tools[] = {"llvm-dwp", "dwp", NULL};
+
+int debuginfo_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_SPLIT_DWARF");
+    return value && *value && !strings_equal(value, "0");
+}
+
+int dwp_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_DWP");
+    return value && *value && !strings_equal(value, "0");
+}
+
+enum debug_option debug_option(const char *arg) {
+    if (arg[0] != '-' || arg[1] != 'g') {
+        return DEBUG_OTHER;
+    }
+    if (strings_equal(arg, "-gsplit-dwarf") || strings_equal_n(arg, "-gz")) {
+        return DEBUG_LAYOUT;
+    }
+    if (strings_equal(arg, "-g0") || strings_equal(arg, "-ggdb0")) {
+        return DEBUG_OFF;
+    }
+    if (strings_equal(arg, "-g") || (arg[2] >= '1' && arg[2] <= '3' && !arg[3]) ||
+        strings_equal_n(arg, "-ggdb") || strings_equal_n(arg, "-gdwarf")) {
+        return DEBUG_ON;
+    }
+    return DEBUG_OTHER;
+}
+
+int add_debuginfo_flags(char *new_argv[], int new_argc, int lto, int link, int features) {
+    // gcc ignores -gsplit-dwarf for LTO compiles.
+    if (!lto) {
+        new_argv[new_argc++] = "-gsplit-dwarf";
+    }
+    new_argv[new_argc++] = features & LINKER_ZSTD ? "-gz=zstd" : "-gz=zlib";
+    if (link && (features & LINKER_GDB_INDEX)) {
+        new_argv[new_argc++] = "-Wl,--gdb-index";
+    }
+    return new_argc;
+}
+
+int debuginfo_exec(struct interceptor_exec *exec, char *envp[]) {
+    const char *output = "a.out";
+    char tool[PATH_MAX];
+    char dwp[PATH_MAX];
+    int split = 0;
+    int found = -1;
+
+    if (!dwp_enabled() || exec->rsp_fd >= 0) {
+        return -1;
+    }
+    for (int i = 1; exec->argv[i]; i++) {
+        const char *arg = exec->argv[i];
+        if (strings_equal(arg, "-c") || strings_equal(arg, "-S") || strings_equal(arg, "-E") ||
+            strings_equal(arg, "-M") || strings_equal(arg, "-MM")) {
+            return -1;
+        }
+        if (strings_equal(arg, "-o") && exec->argv[i + 1]) {
+            output = exec->argv[++i];
+        } else if (debug_option(arg) == DEBUG_LAYOUT) {
+            split |= strings_equal(arg, "-gsplit-dwarf");
+        } else if (debug_option(arg) == DEBUG_OFF) {
+            split = 0;
+        }
+    }
+    for (int i = 0; split && found < 0 && dwp_tools[i]; i++) {
+        found = find_program(dwp_tools[i], tool, sizeof(tool));
+    }
+    if (found < 0 || snprintf(dwp, sizeof(dwp), "%s.dwp", output) >= (int)sizeof(dwp)) {
+        return -1;
+    }
+
+    int status = run_child(exec->pathname, exec->argv, envp, -1, -1);
+    if (status != 0) {
+        return status;
+    }
+    char *argv[] = {tool, "-e", (char *)output, "-o", dwp, NULL};
+    if (run_child(tool, argv, envp, -1, -1) != 0) {
+        fprintf(stderr, "interceptor: %s failed, %s has no .dwp\n", get_basename(tool, '/'), output);
+    }
+    return 0;
+}
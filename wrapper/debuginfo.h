@@ -0,0 +1,31 @@
+#ifndef INTERCEPTOR_DEBUGINFO_H
+#define INTERCEPTOR_DEBUGINFO_H
+
+#include "rewrite.h"
+
+// Debug-info I/O reduction: split DWARF and compressed debug sections.
+
+enum debug_option {
+    DEBUG_OTHER,
+    DEBUG_ON,     // -g, -g1, -ggdb, -gdwarf-4, ...
+    DEBUG_OFF,    // -g0, -ggdb0
+    DEBUG_LAYOUT, // -gsplit-dwarf, -gz: the command already picked a layout
+};
+
+// Nonzero if INTERCEPTOR_SPLIT_DWARF asks for the mode.
+int debuginfo_enabled(void);
+
+// Classifies a -g option.
+enum debug_option debug_option(const char *arg);
+
+// Appends -gsplit-dwarf (unless lto is set), -gz=zstd or -gz=zlib, and for a
+// link, --gdb-index. features are the LINKER_* features of the linker that
+// links the objects. Returns the new argc.
+int add_debuginfo_flags(char *new_argv[], int new_argc, int lto, int link, int features);
+
+// Runs a link of split-DWARF objects and packs their .dwo files into
+// <output>.dwp, if INTERCEPTOR_DWP asks for it. Returns the link's exit
+// status, or -1 if exec isn't such a link and should be exec'd as usual.
+int debuginfo_exec(struct interceptor_exec *exec, char *envp[]);
+
+#endif
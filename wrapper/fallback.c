@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "fallback.h"
+#include "sha256.h"
+#include "toolindex.h"
+#include "util.h"
+
+// Known-bad flags database.
+//
+// $INTERCEPTOR_STATE_DIR/fallback/ has one file per source, named after the
+// hash of its real path, with one line:
+//   <level> <manual> <sha256 of the source> <source realpath>
+// Files are replaced atomically. A recorded level applies while the source's
+// contents hash the same; levels set by hand with `interceptor fallback-set`
+// apply regardless, since they usually cover miscompiles that no compile
+// failure reveals.
+
+const char *const fallback_level_names[FALLBACK_LEVELS] = {"full", "safe", "minimal", "original"};
+
+// Dropped from FALLBACK_SAFE on. Matched as prefixes.
+char *const fallback_aggressive_flags[] = {
+    "-fgraphite-identity", "-floop-nest-optimize", "-fipa-pta", "-fdevirtualize-at-ltrans",
+    "-fno-semantic-interposition", "-malign-data=", "-mtls-dialect=", NULL,
+};
+
+// Kept at FALLBACK_MINIMAL.
+char *const fallback_minimal_flags[] = {"-pipe", "-Wno-error", NULL};
+
+// Diagnostics that blame the flags rather than the source, on lines that
+// report an error (the assembler writes "Error:"). Bare "not supported" or
+// "unsupported" would also match the source's own diagnostics, such as
+// #error "unsupported platform", so they only count after an option.
+char *const fallback_flag_errors[] = {
+    "unrecognized command-line option", "unrecognized command line option", "unrecognized argument",
+    "bad value", "unsupported option", "unsupported argument", "target specific option mismatch",
+    "no such instruction", "Killed signal", NULL,
+};
+
+struct fallback_record {
+    int level;
+    int manual;
+    char hash[SHA256_DIGEST_SIZE * 2 + 1];
+};
+
+int fallback_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_FALLBACK");
+    return value && *value && !strings_equal(value, "0");
+}
+
+// Builds the record file of source into path. Returns 0, or -1 if it doesn't
+// fit.
+int fallback_file(char *path, size_t size, const char *source, int create) {
+    char name[64];
+    snprintf(name, sizeof(name), "fallback/%016llx", (unsigned long long)fnv1a(source, strlen(source)));
+    return create ? state_path(path, size, name) : state_file(path, size, name);
+}
+
+int hash_file(const char *path, char hex[SHA256_DIGEST_SIZE * 2 + 1]) {
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char buf[65536];
+    struct sha256 ctx;
+    ssize_t len;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    sha256_init(&ctx);
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        sha256_update(&ctx, buf, len);
+    }
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    sha256_final(&ctx, digest);
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+    return 0;
+}
+
+// Parses a database line. Returns the source path in it, or NULL.
+const char *parse_record(char *line, struct fallback_record *record) {
+    int offset = -1;
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%d %d %64s %n", &record->level, &record->manual, record->hash, &offset) != 3 ||
+        offset < 0 || record->level < 0 || record->level >= FALLBACK_LEVELS) {
+        return NULL;
+    }
+    return line + offset;
+}
+
+// Reads a record file. Returns the source path in it, or NULL.
+const char *read_record(const char *path, char *line, size_t size, struct fallback_record *record) {
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        return NULL;
+    }
+    const char *source = fgets(line, size, file) ? parse_record(line, record) : NULL;
+    fclose(file);
+    return source;
+}
+
+// Finds the record for source. Returns -1 if there is none.
+int fallback_find(const char *source, struct fallback_record *record) {
+    char path[PATH_MAX];
+    char line[PATH_MAX + 128];
+
+    if (fallback_file(path, sizeof(path), source, 0) != 0) {
+        return -1;
+    }
+    const char *recorded = read_record(path, line, sizeof(line), record);
+    return recorded && strings_equal(recorded, source) ? 0 : -1;
+}
+
+// Records level for source; a full record that isn't pinned by hand removes
+// the file.
+int fallback_record(const char *source, int level, int manual, const char *hash) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    char line[PATH_MAX + 128];
+
+    if (fallback_file(path, sizeof(path), source, 1) != 0) {
+        return -1;
+    }
+    if (level == FALLBACK_FULL && !manual) {
+        return unlink(path) == 0 || errno == ENOENT ? 0 : -1;
+    }
+    int len = snprintf(line, sizeof(line), "%d %d %s %s\n", level, manual, hash, source);
+    if (len < 0 || len >= (int)sizeof(line) || snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return -1;
+    }
+    int ok = write(fd, line, len) == len && fchmod(fd, 0644) == 0;
+    if (close(fd) != 0 || !ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int match_prefix(const char *str, char *const list[]) {
+    for (int i = 0; list[i]; i++) {
+        if (strings_equal_n(str, list[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Builds the command of exec at level into variant.
+void fallback_variant(struct interceptor_exec *exec, enum fallback_level level, struct interceptor_exec *variant) {
+    *variant = *exec;
+    if (level == FALLBACK_FULL) {
+        return;
+    }
+    if (level == FALLBACK_ORIGINAL || exec->rsp_fd >= 0 || !exec->added) {
+        variant->pathname = exec->original_pathname;
+        variant->argv = exec->original_argv;
+        return;
+    }
+    int argc = 0;
+    while (exec->argv[argc]) {
+        argc++;
+    }
+    char **argv = exec_alloc(exec, (argc + 2) * sizeof(char *));
+    int new_argc = 0;
+    for (int i = 0; i < argc; i++) {
+        const char *arg = exec->argv[i];
+        if (i >= exec->added) {
+            if (level == FALLBACK_MINIMAL && !match_list(arg, fallback_minimal_flags)) {
+                continue;
+            }
+            if (match_prefix(arg, fallback_aggressive_flags)) {
+                continue;
+            }
+        }
+        argv[new_argc++] = (char *)arg;
+    }
+    if (level == FALLBACK_MINIMAL) {
+        argv[new_argc++] = "-O2";
+    }
+    argv[new_argc] = NULL;
+    variant->argv = argv;
+}
+
+int run_compile(struct interceptor_exec *exec, char *envp[]) {
+    int status = cache_enabled() ? cache_exec(exec, envp) : -1;
+    if (status < 0) {
+        status = run_child(exec->pathname, exec->argv, envp, -1, -1);
+    }
+    return status;
+}
+
+// Runs one attempt with its stderr held in a memfd, so diagnostics of failed
+// attempts can be dropped.
+int run_attempt(struct interceptor_exec *exec, char *envp[], int *err) {
+    *err = memfd_create("interceptor-stderr", MFD_CLOEXEC);
+    int saved = dup(STDERR_FILENO);
+    if (*err < 0 || saved < 0) {
+        return run_compile(exec, envp);
+    }
+    fflush(stderr);
+    dup2(*err, STDERR_FILENO);
+    int status = run_compile(exec, envp);
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    return status;
+}
+
+void flush_attempt(int err) {
+    char buf[65536];
+    ssize_t len;
+    if (err < 0) {
+        return;
+    }
+    lseek(err, 0, SEEK_SET);
+    while ((len = read(err, buf, sizeof(buf))) > 0) {
+        if (write(STDERR_FILENO, buf, len) != len) {
+            break;
+        }
+    }
+    close(err);
+}
+
+// Nonzero if the message of an error line says an option such as -mavx512f
+// or '-fcf-protection' is not supported.
+int option_unsupported(const char *line) {
+    const char *message = strstr(line, "rror: ");
+    const char *end = message ? strstr(message, "not supported") : NULL;
+    for (const char *p = message; end && (p = strchr(p, '-')) && p < end; p++) {
+        // After a space or a quote, which gcc may write as UTF-8.
+        if ((p[1] == 'm' || p[1] == 'f') && !isalnum((unsigned char)p[-1]) && p[-1] != '-') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Nonzero if an attempt that exited with status failed because of its
+// flags: an internal compiler error (status 4), or diagnostics in err that
+// point at an option.
+int flags_failed(int status, int err) {
+    char *line = NULL;
+    size_t size = 0;
+    int found = status == 4;
+
+    if (found || err < 0) {
+        return found;
+    }
+    lseek(err, 0, SEEK_SET);
+    FILE *file = fdopen(dup(err), "r");
+    if (!file) {
+        return 0;
+    }
+    while (!found && getline(&line, &size, file) > 0) {
+        found = strstr(line, "internal compiler error") != NULL;
+        if (found || !strstr(line, "rror: ") || strstr(line, "#error")) {
+            continue;
+        }
+        found = option_unsupported(line);
+        for (int i = 0; !found && fallback_flag_errors[i]; i++) {
+            found = strstr(line, fallback_flag_errors[i]) != NULL;
+        }
+    }
+    fclose(file);
+    free(line);
+    return found;
+}
+
+int fallback_exec(struct interceptor_exec *exec, char *envp[]) {
+    struct fallback_record record = {FALLBACK_FULL, 0, "-"};
+    char source[PATH_MAX];
+    char hash[SHA256_DIGEST_SIZE * 2 + 1] = "-";
+    const char *arg = compile_source(exec->argv);
+    int start = FALLBACK_FULL;
+    int stale = 0;
+
+    if (!arg || !realpath(arg, source)) {
+        return -1;
+    }
+    // The source is only hashed when there is a record to check it against.
+    if (fallback_find(source, &record) == 0 && record.level != FALLBACK_FULL) {
+        if (record.manual || (hash_file(source, hash) == 0 && strings_equal(hash, record.hash))) {
+            start = record.level;
+        } else {
+            stale = 1;
+        }
+    }
+
+    int status = -1;
+    int err = -1;
+    int used = -1;
+    for (int level = start; level < FALLBACK_LEVELS; level++) {
+        struct interceptor_exec variant;
+        // Without the appended flags in view every reduced level is the
+        // original command.
+        if (level != start && level < FALLBACK_ORIGINAL && (exec->rsp_fd >= 0 || !exec->added)) {
+            continue;
+        }
+        fallback_variant(exec, level, &variant);
+        if (err >= 0) {
+            close(err);
+        }
+        status = run_attempt(&variant, envp, &err);
+        if (status == 0) {
+            if (level != start) {
+                if (!strings_equal(hash, "-") || hash_file(source, hash) == 0) {
+                    fallback_record(source, level, 0, hash);
+                }
+                used = level;
+            } else if (stale) {
+                // The edited source builds with the full flags again.
+                fallback_record(source, FALLBACK_FULL, 0, hash);
+            }
+            break;
+        }
+        // Signals, a missing compiler and errors in the source aren't the
+        // flags' fault.
+        if (status < 0 || status > 125 || !flags_failed(status, err)) {
+            break;
+        }
+    }
+    // On failure the diagnostics of the last, most conservative attempt show.
+    flush_attempt(err);
+    if (used >= 0) {
+        fprintf(stderr, "interceptor: %s compiled with the %s flag set\n", arg, fallback_level_names[used]);
+    }
+    return status < 0 ? 1 : status;
+}
+
+int fallback_set(const char *level_name, char *sources[], int count) {
+    char source[PATH_MAX];
+    int level = -1;
+
+    for (int i = 0; i < FALLBACK_LEVELS; i++) {
+        if (strings_equal(level_name, fallback_level_names[i])) {
+            level = i;
+        }
+    }
+    if (level < 0) {
+        fprintf(stderr, "interceptor: unknown level %s (full, safe, minimal, original)\n", level_name);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!realpath(sources[i], source)) {
+            perror(sources[i]);
+            return 1;
+        }
+        // A full record by hand clears the source's entry.
+        if (fallback_record(source, level, level != FALLBACK_FULL, "-") != 0) {
+            perror(sources[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int fallback_list(void) {
+    char dir_path[PATH_MAX];
+    char path[PATH_MAX];
+    char line[PATH_MAX + 128];
+    struct dirent *ent;
+
+    if (state_file(dir_path, sizeof(dir_path), "fallback") != 0) {
+        return 1;
+    }
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return 0;
+    }
+    while ((ent = readdir(dir))) {
+        struct fallback_record record;
+        if (ent->d_name[0] == '.' || strchr(ent->d_name, '.') ||
+            snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+        const char *source = read_record(path, line, sizeof(line), &record);
+        if (source && record.level != FALLBACK_FULL) {
+            printf("%s %s %s\n", fallback_level_names[record.level], record.manual ? "manual" : "auto", source);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef INTERCEPTOR_FALLBACK_H
+#define INTERCEPTOR_FALLBACK_H
+
+#include "rewrite.h"
+
+// Flag sets tried in order when a compile fails.
+enum fallback_level {
+    FALLBACK_FULL,     // everything the wrapper adds
+    FALLBACK_SAFE,     // without the aggressive optimizations
+    FALLBACK_MINIMAL,  // -march/-mtune=native, -pipe, -Wno-error and -O2 only
+    FALLBACK_ORIGINAL, // the command as the build ran it
+    FALLBACK_LEVELS,
+};
+
+// Nonzero if INTERCEPTOR_FALLBACK asks for supervised compiles.
+int fallback_enabled(void);
+
+// Runs the compile in exec at the level recorded for its source, retrying at
+// the following levels on failure, and records the level that worked.
+// Returns the exit status, or -1 if the command isn't a single-source compile.
+int fallback_exec(struct interceptor_exec *exec, char *envp[]);
+
+// `interceptor fallback-set <level> <source>...` and `fallback-list`.
+int fallback_set(const char *level, char *sources[], int count);
+int fallback_list(void);
+
+#endif
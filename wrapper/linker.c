@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "linker.h"
+#include "toolindex.h"
+#include "util.h"
+
+// Which linkers a compiler can use is found by linking a trivial program
+// with each installed one: plainly, with LTO, and with zstd-compressed debug
+// info. A linker that can't load the plugin fails the LTO link, as main only
+// exists as GIMPLE. The features of all linkers are cached as one bitmask in
+// tools.idx under the compiler's path and a hash of PATH. One process probes
+// at a time, under an flock on linker.lock in the state directory; links that
+// come meanwhile keep the compiler's default linker.
+
+#define LINKER_PROBED (1u << 30)
+#define LINKER_SHIFT(i) (4 * (i))
+#define LINKER_PROBED_FEATURES (LINKER_USABLE | LINKER_PLUGIN | LINKER_ZSTD)
+
+struct linker {
+    const char *name;
+    const char *threads; // -Wl option that sets the thread count
+    int serial;          // single-threaded unless told otherwise
+    int features;        // LINKER_* features that need no probe
+};
+
+// Fastest first.
+const struct linker linkers[] = {
+    {"mold", "-Wl,--threads=%d", 0, LINKER_GDB_INDEX},
+    {"lld", "-Wl,--threads=%d", 0, LINKER_GDB_INDEX},
+    {"gold", "-Wl,--threads,--thread-count=%d", 1, LINKER_GDB_INDEX},
+    {"bfd", NULL, 1, 0},
+    {NULL, NULL, 0, 0},
+};
+
+extern char **environ;
+
+// Returns nonzero if ld.<name> is in PATH, where collect2 looks for it.
+int linker_installed(const char *name) {
+    char program[32];
+    char path[PATH_MAX];
+    snprintf(program, sizeof(program), "ld.%s", name);
+    return find_program(program, path, sizeof(path)) == 0;
+}
+
+int linker_probe(const char *compiler, const char *dir, const char *name, int feature) {
+    char fuse_ld[32];
+    char source[PATH_MAX];
+    char output[PATH_MAX];
+    char *argv[16];
+    int argc = 0;
+
+    snprintf(fuse_ld, sizeof(fuse_ld), "-fuse-ld=%s", name);
+    snprintf(source, sizeof(source), "%s/probe.c", dir);
+    snprintf(output, sizeof(output), "%s/probe", dir);
+    argv[argc++] = (char *)compiler;
+    argv[argc++] = fuse_ld;
+    if (feature == LINKER_PLUGIN) {
+        argv[argc++] = "-flto";
+        argv[argc++] = "-fno-fat-lto-objects";
+        argv[argc++] = "-fuse-linker-plugin";
+    } else if (feature == LINKER_ZSTD) {
+        argv[argc++] = "-g";
+        argv[argc++] = "-gz=zstd";
+    }
+    argv[argc++] = source;
+    argv[argc++] = "-o";
+    argv[argc++] = output;
+    argv[argc] = NULL;
+
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    interceptor_probing = 1;
+    int status = run_child(compiler, argv, environ, devnull, devnull);
+    interceptor_probing = 0;
+    if (devnull >= 0) {
+        close(devnull);
+    }
+    unlink(output);
+    return status == 0;
+}
+
+// Builds the tools.idx key of compiler's probe results: its path and a hash
+// of PATH, where collect2 looks for the linkers. Returns 0, or -1 if it
+// doesn't fit.
+int linker_key(const char *compiler, char *key, size_t size) {
+    const char *path = getenv("PATH");
+    path = path ? path : "";
+    int n = snprintf(key, size, "%s %016llx", compiler, (unsigned long long)fnv1a(path, strlen(path)));
+    return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+// Links a trivial program with every installed linker. Returns the features
+// found, with LINKER_PROBED set, or 0 if it couldn't write the program.
+uint32_t linker_probe_all(const char *compiler) {
+    const char *tmpdir = getenv("TMPDIR");
+    char dir[PATH_MAX];
+    char source[PATH_MAX];
+    uint32_t usable = 0;
+
+    int len = snprintf(dir, sizeof(dir), "%s/interceptor-ld-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+    if (len < 0 || (size_t)len >= sizeof(dir) || !mkdtemp(dir)) {
+        return usable;
+    }
+    // The paths linker_probe() builds in dir are no longer than source.
+    int fits = snprintf(source, sizeof(source), "%s/probe.c", dir) < (int)sizeof(source);
+    FILE *file = fits ? fopen(source, "we") : NULL;
+    if (file && fputs("int main(void) { return 0; }\n", file) >= 0 && fclose(file) == 0) {
+        usable = LINKER_PROBED;
+        for (int i = 0; linkers[i].name; i++) {
+            if (!linker_installed(linkers[i].name) || !linker_probe(compiler, dir, linkers[i].name, LINKER_USABLE)) {
+                continue;
+            }
+            usable |= LINKER_USABLE << LINKER_SHIFT(i);
+            if (linker_probe(compiler, dir, linkers[i].name, LINKER_PLUGIN)) {
+                usable |= LINKER_PLUGIN << LINKER_SHIFT(i);
+            }
+            if (linker_probe(compiler, dir, linkers[i].name, LINKER_ZSTD)) {
+                usable |= LINKER_ZSTD << LINKER_SHIFT(i);
+            }
+        }
+    } else if (file) {
+        fclose(file);
+    }
+    unlink(source);
+    rmdir(dir);
+    return usable;
+}
+
+// Returns the cached features of the linkers compiler can use, probing them
+// first if needed and cached isn't set. Returns 0, which picks no linker,
+// while another process probes.
+uint32_t linker_detect(const char *compiler, int cached) {
+    char key[PATH_MAX + 32];
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (stat(compiler, &st) != 0 || linker_key(compiler, key, sizeof(key)) != 0) {
+        return LINKER_PROBED;
+    }
+    uint32_t usable = tool_index_lookup(key, &st);
+    if ((usable & LINKER_PROBED) || cached) {
+        return usable;
+    }
+    int lock = state_path(path, sizeof(path), "linker.lock") == 0 ? open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        if (lock >= 0) {
+            close(lock);
+        }
+        return 0;
+    }
+    // The process that held the lock may have probed this compiler.
+    usable = tool_index_lookup(key, &st);
+    if (!(usable & LINKER_PROBED)) {
+        usable = linker_probe_all(compiler);
+        if (usable) {
+            tool_index_store(key, &st, usable);
+        }
+    }
+    flock(lock, LOCK_UN);
+    close(lock);
+    return usable;
+}
+
+int linker_choose(const char *compiler, int lto, int *features, int cached) {
+    uint32_t usable = linker_detect(compiler, cached);
+
+    for (int i = 0; linkers[i].name; i++) {
+        int probed = (usable >> LINKER_SHIFT(i)) & LINKER_PROBED_FEATURES;
+        if (probed & (lto ? LINKER_PLUGIN : LINKER_USABLE)) {
+            *features = probed | linkers[i].features;
+            return i;
+        }
+    }
+    *features = 0;
+    return -1;
+}
+
+int add_linker_flags(struct interceptor_exec *exec, int linker, char *new_argv[], int new_argc, int jobs) {
+    char *fuse_ld = exec_alloc(exec, 32);
+    snprintf(fuse_ld, 32, "-fuse-ld=%s", linkers[linker].name);
+    new_argv[new_argc++] = fuse_ld;
+    if (linkers[linker].threads && (jobs > 1 || !linkers[linker].serial)) {
+        char *threads = exec_alloc(exec, 64);
+        snprintf(threads, 64, linkers[linker].threads, jobs);
+        new_argv[new_argc++] = threads;
+    }
+    return new_argc;
+}
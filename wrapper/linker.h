@@ -0,0 +1,23 @@
+#ifndef INTERCEPTOR_LINKER_H
+#define INTERCEPTOR_LINKER_H
+
+#include "rewrite.h"
+
+// Linker features
+#define LINKER_USABLE 1    // links with the compiler
+#define LINKER_PLUGIN 2    // loads gcc's LTO plugin
+#define LINKER_ZSTD 4      // handles -gz=zstd
+#define LINKER_GDB_INDEX 8 // supports --gdb-index
+
+// Picks the fastest linker compiler can run (mold, lld, gold, then bfd). If
+// lto is set, only linkers that load gcc's LTO plugin qualify. features
+// receives the LINKER_* features of the linker. Returns -1 if none was found.
+// With cached set, a compiler that hasn't been probed yet isn't probed and
+// keeps its default linker.
+int linker_choose(const char *compiler, int lto, int *features, int cached);
+
+// Appends -fuse-ld= for linker and its thread count for jobs threads. Returns
+// the new argc.
+int add_linker_flags(struct interceptor_exec *exec, int linker, char *new_argv[], int new_argc, int jobs);
+
+#endif
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "native.h"
+#include "toolindex.h"
+#include "util.h"
+
+// Resolutions are stored in $INTERCEPTOR_STATE_DIR/native/<key>, one flag per
+// line; an empty file means the compiler's output couldn't be parsed. The key
+// hashes the compiler binary (path, inode, size, mtime), the target CPU and,
+// for native, the host CPU's identity, so upgrading the compiler or moving to
+// another CPU model resolves again. native/cpu caches that identity for the
+// current boot.
+
+#define NATIVE_FILE_BYTES 16384
+#define NATIVE_MAX_FLAGS 512
+
+extern char **environ;
+
+// INTERCEPTOR_MARCH: unset or "native" resolves the host CPU, "off" keeps
+// -march=native, anything else pins that CPU.
+const char *native_cpu(void) {
+    const char *cpu = getenv("INTERCEPTOR_MARCH");
+    if (!cpu || !*cpu) {
+        return "native";
+    }
+    return strings_equal(cpu, "off") ? NULL : cpu;
+}
+
+// Hashes the host CPU's identity from the first processor of /proc/cpuinfo;
+// the rest only repeat it. Returns 0 if it can't be read.
+uint64_t cpu_hash(void) {
+    char buf[8192];
+    char line[4096];
+    size_t len = 0;
+
+    FILE *file = fopen("/proc/cpuinfo", "re");
+    if (!file) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) && !strings_equal(line, "\n")) {
+        if (strings_equal_n(line, "vendor_id") || strings_equal_n(line, "cpu family") ||
+            strings_equal_n(line, "model") || strings_equal_n(line, "flags") ||
+            strings_equal_n(line, "Features") || strings_equal_n(line, "CPU ")) {
+            size_t n = strlen(line);
+            if (len + n < sizeof(buf)) {
+                memcpy(buf + len, line, n);
+                len += n;
+            }
+        }
+    }
+    fclose(file);
+    return len ? fnv1a(buf, len) : 0;
+}
+
+// Returns the CPU hash, parsing /proc/cpuinfo only once per boot: the hash
+// is kept in native/cpu next to the boot_id it was computed under. With
+// cached set, returns 0 instead of parsing it.
+uint64_t cpu_hash_cached(int cached) {
+    char boot_id[64] = "";
+    char data[128];
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    unsigned long long hash;
+
+    int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return cached ? 0 : cpu_hash();
+    }
+    ssize_t n = read(fd, boot_id, sizeof(boot_id) - 1);
+    close(fd);
+    boot_id[n > 0 ? strcspn(boot_id, "\n") : 0] = '\0';
+    if (!*boot_id || state_file(path, sizeof(path), "native/cpu") != 0) {
+        return cached ? 0 : cpu_hash();
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        n = read(fd, data, sizeof(data) - 1);
+        close(fd);
+        data[n > 0 ? n : 0] = '\0';
+        size_t id_len = strlen(boot_id);
+        if (strncmp(data, boot_id, id_len) == 0 && data[id_len] == ' ' &&
+            sscanf(data + id_len + 1, "%llx", &hash) == 1) {
+            return hash;
+        }
+    }
+    if (cached) {
+        return 0;
+    }
+
+    hash = cpu_hash();
+    int len = snprintf(data, sizeof(data), "%s %016llx\n", boot_id, hash);
+    if (!hash || len >= (int)sizeof(data) || state_path(path, sizeof(path), "native/cpu") != 0 ||
+        snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        return hash;
+    }
+    fd = mkstemp(tmp);
+    if (fd >= 0) {
+        int ok = write(fd, data, len) == len && fchmod(fd, 0644) == 0;
+        if (close(fd) == 0 && ok) {
+            rename(tmp, path);
+        } else {
+            unlink(tmp);
+        }
+    }
+    return hash;
+}
+
+int native_key(const char *compiler, const char *cpu, int cached, char *key, size_t size) {
+    char buf[PATH_MAX + 256];
+    struct stat st;
+
+    if (stat(compiler, &st) != 0) {
+        return -1;
+    }
+    unsigned long long host = strings_equal(cpu, "native") ? cpu_hash_cached(cached) : 0;
+    if (cached && strings_equal(cpu, "native") && !host) {
+        return -1;
+    }
+    int len = snprintf(buf, sizeof(buf), "%s %llu %llu %lld %lld.%ld %s %016llx\n", compiler,
+                       (unsigned long long)st.st_dev, (unsigned long long)st.st_ino, (long long)st.st_size,
+                       (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, cpu, host);
+    if (len < 0 || len >= (int)sizeof(buf)) {
+        return -1;
+    }
+    snprintf(key, size, "native/%016llx", (unsigned long long)fnv1a(buf, len));
+    return 0;
+}
+
+// Copies the next argument of a `gcc -###` command line, which quotes
+// arguments with "..." and backslash escapes, to out. Returns the position
+// after it, or NULL at the end of the line.
+const char *next_token(const char *p, char *out, size_t size) {
+    size_t len = 0;
+    while (*p == ' ') {
+        p++;
+    }
+    if (!*p || *p == '\n') {
+        return NULL;
+    }
+    int quoted = *p == '"';
+    p += quoted;
+    for (; *p && *p != '\n' && (quoted ? *p != '"' : *p != ' '); p++) {
+        if (quoted && *p == '\\' && p[1]) {
+            p++;
+        }
+        if (len + 1 < size) {
+            out[len++] = *p;
+        }
+    }
+    out[len] = '\0';
+    return *p == '"' ? p + 1 : p;
+}
+
+// Asks compiler what the target CPU expands into and writes the -march,
+// -mtune, -m<feature> and cache --param flags it passes to cc1 into data,
+// one per line. Returns the length, or 0 if there is nothing to use.
+size_t native_detect(const char *compiler, const char *cpu, char *data, size_t size) {
+    char march[128];
+    char mtune[128];
+    char token[256];
+    static char out[NATIVE_FILE_BYTES];
+
+    snprintf(march, sizeof(march), "-march=%s", cpu);
+    snprintf(mtune, sizeof(mtune), "-mtune=%s", cpu);
+    char *argv[] = {(char *)compiler, "-###", march, mtune, "-E", "-x", "c", "/dev/null", NULL};
+    int fd = memfd_create("interceptor-native", MFD_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    interceptor_probing = 1;
+    int status = run_child(compiler, argv, environ, devnull, fd);
+    interceptor_probing = 0;
+    if (devnull >= 0) {
+        close(devnull);
+    }
+    ssize_t n = status == 0 ? pread(fd, out, sizeof(out) - 1, 0) : -1;
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    out[n] = '\0';
+
+    size_t len = 0;
+    int has_march = 0;
+    for (const char *line = out; line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        const char *p = next_token(line, token, sizeof(token));
+        const char *base = p ? get_basename(token, '/') : NULL;
+        if (!base || !(strings_equal(base, "cc1") || strings_equal(base, "cc1plus"))) {
+            continue;
+        }
+        while ((p = next_token(p, token, sizeof(token)))) {
+            int param = strings_equal(token, "--param");
+            if (param) {
+                p = next_token(p, token, sizeof(token));
+                if (!p || !(strings_equal_n(token, "l1-cache") || strings_equal_n(token, "l2-cache"))) {
+                    continue;
+                }
+            } else if (token[0] != '-' || token[1] != 'm') {
+                continue;
+            }
+            has_march |= strings_equal_n(token, "-march=");
+            int written = snprintf(data + len, size - len, "%s%s\n", param ? "--param=" : "", token);
+            if (written < 0 || (size_t)written >= size - len) {
+                return 0;
+            }
+            len += written;
+        }
+        break;
+    }
+    return has_march ? len : 0;
+}
+
+int native_flags(struct interceptor_exec *exec, const char *compiler, char ***flags) {
+    char key[32];
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    const char *cpu = native_cpu();
+
+    if (!cpu || native_key(compiler, cpu, exec->arena != NULL, key, sizeof(key)) != 0 || state_file(path, sizeof(path), key) != 0) {
+        return 0;
+    }
+    char *data = exec_alloc(exec, NATIVE_FILE_BYTES);
+    ssize_t len = -1;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        len = read(fd, data, NATIVE_FILE_BYTES - 1);
+        close(fd);
+    }
+    // Execs without a heap don't run the compiler to resolve.
+    if (len < 0 && exec->arena) {
+        return 0;
+    }
+    if (len < 0) {
+        len = native_detect(compiler, cpu, data, NATIVE_FILE_BYTES);
+        // Failures are stored too, so a compiler that can't be resolved isn't
+        // asked again on every exec.
+        if (state_path(path, sizeof(path), key) == 0 &&
+            snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) < (int)sizeof(tmp)) {
+            fd = mkstemp(tmp);
+            if (fd >= 0) {
+                int ok = write(fd, data, len) == len && fchmod(fd, 0644) == 0;
+                if (close(fd) == 0 && ok) {
+                    rename(tmp, path);
+                } else {
+                    unlink(tmp);
+                }
+            }
+        }
+    }
+    data[len] = '\0';
+
+    int count = 0;
+    char **list = exec_alloc(exec, NATIVE_MAX_FLAGS * sizeof(char *));
+    for (char *line = data; *line && count < NATIVE_MAX_FLAGS; line++) {
+        list[count++] = line;
+        line += strcspn(line, "\n");
+        if (!*line) {
+            break;
+        }
+        *line = '\0';
+    }
+    *flags = list;
+    return count;
+}
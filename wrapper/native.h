@@ -0,0 +1,16 @@
+#ifndef INTERCEPTOR_NATIVE_H
+#define INTERCEPTOR_NATIVE_H
+
+#include "rewrite.h"
+
+// Resolves the -march=native -mtune=native the wrapper adds into the
+// explicit CPU and feature flags they stand for, or into the CPU pinned with
+// INTERCEPTOR_MARCH.
+
+// Stores in *flags the flags compiler expands the target CPU into, allocated
+// for exec. Returns their number, or 0 if the compiler should get
+// -march=native -mtune=native as they are, which is also what an exec with
+// an arena gets until the wrapper has resolved the CPU.
+int native_flags(struct interceptor_exec *exec, const char *compiler, char ***flags);
+
+#endif
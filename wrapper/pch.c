@@ -0,0 +1,747 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "pch.h"
+#include "probe.h"
+#include "rules.h"
+#include "toolindex.h"
+#include "util.h"
+
+// Precompiled headers, learned from the compiles the wrapper sees.
+//
+// Compiles are grouped by compiler, working directory, language and flags,
+// less the source, output and dependency options. Each group has a directory
+// $INTERCEPTOR_STATE_DIR/pch/<group key> with a usage file that lists, per
+// source, the #include lines the source starts with, before anything else.
+// A compile takes the prefix of its own list that the most sources of the
+// group share, counting each header once per source that starts with it,
+// and uses a PCH of that prefix once PCH_MIN_SOURCES sources share it.
+//
+// The PCH lives in <group>/<prefix key>, as interceptor-pch.h, which
+// includes the headers of the prefix, and interceptor-pch.h.gch, built with
+// the compile's own flags. The compile gets -include interceptor-pch.h, and
+// its own #include lines of the same headers then find their include guards
+// defined. gcc -H reports the headers without guards; a prefix stops in
+// front of one. interceptor-pch.deps lists what the PCH was built from, with
+// inode, size and mtime, and goes last. A PCH whose list no longer matches
+// is rebuilt by the next compile that wants it.
+
+#define PCH_VERSION "interceptor-pch-1"
+#define PCH_HEADER "interceptor-pch.h"
+#define PCH_MAX_HEADERS 32
+#define PCH_MIN_SOURCES 3
+// Leading includes are looked for in this much of a source.
+#define PCH_SCAN_BYTES 65536
+#define PCH_GUARDS_LINE "Multiple include guards may be useful for:"
+
+enum pch_stat {
+    PCH_USED,
+    PCH_BUILT,
+    PCH_STALE,
+    PCH_FAILED,
+    PCH_BUSY,
+    PCH_STAT_COUNT,
+};
+
+const char *const pch_stat_names[PCH_STAT_COUNT] = {"used", "built", "stale", "failed", "busy"};
+
+char *const pch_cxx_suffixes[] = {".cc", ".cp", ".cxx", ".cpp", ".CPP", ".c++", ".C", NULL};
+char *const pch_cxx_drivers[] = {"g++", "c++", "xg++", NULL};
+
+struct pch_job {
+    const char *source;
+    const char *lang; // -x value for the PCH
+    // The source's leading #include targets, as the PCH header writes them.
+    char *headers[PCH_MAX_HEADERS];
+    int count;
+    char group[PATH_MAX];
+    char dir[PATH_MAX];
+};
+
+long long pch_files;
+long long pch_bytes;
+
+int pch_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_PCH");
+    return value && *value && !strings_equal(value, "0");
+}
+
+void pch_count(enum pch_stat stat) {
+    char path[PATH_MAX];
+    long long deltas[PCH_STAT_COUNT] = {0};
+    deltas[stat] = 1;
+    if (state_path(path, sizeof(path), "pch/stats") == 0) {
+        counters_update(path, pch_stat_names, deltas, NULL, PCH_STAT_COUNT);
+    }
+}
+
+// Copies the flags of argv that a PCH has to be built with into flags:
+// everything but the source, -c, the output and dependency options, and the
+// per-object profile directories of PGO, which gcc doesn't check PCHs
+// against. Returns their count.
+int pch_flags(char *argv[], const char *source, char *flags[]) {
+    int count = 0;
+    for (int i = 0; argv[i]; i++) {
+        const char *arg = argv[i];
+        if (i > 0 && (strings_equal(arg, "-o") || strings_equal(arg, "-MF") ||
+                      strings_equal(arg, "-MT") || strings_equal(arg, "-MQ"))) {
+            i++;
+            continue;
+        }
+        if (i > 0 && (arg == source || strings_equal(arg, "-c") || strings_equal(arg, "-MD") ||
+                      strings_equal(arg, "-MMD") || strings_equal(arg, "-MP") ||
+                      strings_equal_n(arg, "-Wp,-M") || strings_equal_n(arg, "-o") ||
+                      strings_equal_n(arg, "-MF") || strings_equal_n(arg, "-MT") ||
+                      strings_equal_n(arg, "-MQ") || strings_equal_n(arg, "-fprofile-generate=") ||
+                      strings_equal_n(arg, "-fprofile-use="))) {
+            continue;
+        }
+        flags[count++] = (char *)arg;
+    }
+    return count;
+}
+
+// Picks the language of the PCH. Returns -1 if the command already
+// includes files of its own ahead of the source, or isn't C or C++.
+int pch_parse(struct interceptor_exec *exec, struct pch_job *job) {
+    for (int i = 1; exec->argv[i]; i++) {
+        const char *arg = exec->argv[i];
+        if (strings_equal_n(arg, "-include") || strings_equal_n(arg, "-imacros") || strings_equal_n(arg, "-x")) {
+            return -1;
+        }
+    }
+    char driver[RULE_PATTERN_MAX];
+    rules_match(exec->pathname, driver, sizeof(driver));
+    size_t len = strlen(job->source);
+    if (has_suffix(job->source, pch_cxx_suffixes) || (len > 2 && strings_equal(job->source + len - 2, ".c") &&
+                                                       match_list(driver, pch_cxx_drivers))) {
+        job->lang = "c++-header";
+    } else if (len > 2 && strings_equal(job->source + len - 2, ".c")) {
+        job->lang = "c-header";
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Skips blanks and comments, and newlines too with lines set.
+const char *pch_skip(const char *p, const char *end, int lines) {
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f' || *p == '\v' || (lines && *p == '\n')) {
+            p++;
+        } else if (end - p >= 2 && p[0] == '/' && p[1] == '*') {
+            const char *close = memmem(p + 2, end - p - 2, "*/", 2);
+            p = close ? close + 2 : end;
+        } else if (end - p >= 2 && p[0] == '/' && p[1] == '/') {
+            const char *newline = memchr(p, '\n', end - p);
+            p = newline ? newline : end;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+// Collects the #include lines the source starts with, up to the first line
+// that is anything else. A quoted header next to the source is written with
+// its absolute path, since the PCH header lives elsewhere.
+void pch_scan(struct interceptor_exec *exec, struct pch_job *job) {
+    char *data = exec_alloc(exec, PCH_SCAN_BYTES);
+    char path[PATH_MAX];
+    char real[PATH_MAX];
+    ssize_t len = -1;
+
+    job->count = 0;
+    int fd = open(job->source, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        len = read(fd, data, PCH_SCAN_BYTES);
+        close(fd);
+    }
+    const char *p = data;
+    const char *end = data + (len > 0 ? len : 0);
+    const char *slash = strrchr(job->source, '/');
+    int dir_len = slash ? slash - job->source : 1;
+    const char *dir = slash ? job->source : ".";
+
+    while (job->count < PCH_MAX_HEADERS) {
+        p = pch_skip(p, end, 1);
+        if (p == end || *p != '#') {
+            break;
+        }
+        p = pch_skip(p + 1, end, 0);
+        if (end - p < 7 || strncmp(p, "include", 7) != 0) {
+            break;
+        }
+        p = pch_skip(p + 7, end, 0);
+        if (p == end || (*p != '"' && *p != '<')) {
+            break;
+        }
+        char close = *p == '"' ? '"' : '>';
+        const char *name = ++p;
+        while (p < end && *p != close && *p != '\n' && *p != '\t') {
+            p++;
+        }
+        if (p == end || *p != close || p == name) {
+            break;
+        }
+        int name_len = p - name;
+        p = pch_skip(p + 1, end, 0);
+        if (p == end || *p != '\n') {
+            break;
+        }
+        int n;
+        if (close == '"' && name[0] != '/' &&
+            snprintf(path, sizeof(path), "%.*s/%.*s", dir_len, dir, name_len, name) < (int)sizeof(path) &&
+            realpath(path, real) && !strpbrk(real, "\"\\\t\n")) {
+            n = snprintf(path, sizeof(path), "\"%s\"", real);
+        } else {
+            n = snprintf(path, sizeof(path), "%c%.*s%c", close == '"' ? '"' : '<', name_len, name, close);
+        }
+        int seen = n >= (int)sizeof(path);
+        for (int i = 0; !seen && i < job->count; i++) {
+            seen = strings_equal(job->headers[i], path);
+        }
+        if (seen) {
+            break;
+        }
+        job->headers[job->count] = exec_alloc(exec, n + 1);
+        memcpy(job->headers[job->count++], path, n + 1);
+    }
+}
+
+// Builds the group directory from the compiler identity, working directory,
+// language and flags of exec.
+int pch_group(struct interceptor_exec *exec, struct pch_job *job, char *flags[], int count) {
+    char cwd[PATH_MAX];
+    char key[64];
+    struct stat st;
+
+    if (stat(exec->pathname, &st) != 0 || !getcwd(cwd, sizeof(cwd))) {
+        return -1;
+    }
+    size_t size = 256 + strlen(exec->pathname) + strlen(cwd);
+    for (int i = 0; i < count; i++) {
+        size += strlen(flags[i]) + 1;
+    }
+    char *buf = malloc(size);
+    if (!buf) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = snprintf(buf, size, "%s %s %llu %lld %lld.%ld %s %s", PCH_VERSION, exec->pathname,
+                          (unsigned long long)st.st_ino, (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+                          st.st_mtim.tv_nsec, cwd, job->lang) + 1;
+    for (int i = 0; i < count; i++) {
+        size_t n = strlen(flags[i]) + 1;
+        memcpy(buf + len, flags[i], n);
+        len += n;
+    }
+    snprintf(key, sizeof(key), "pch/%016llx/.lock", (unsigned long long)fnv1a(buf, len));
+    free(buf);
+    if (state_path(job->group, sizeof(job->group), key) != 0) {
+        return -1;
+    }
+    *strrchr(job->group, '/') = '\0';
+    return 0;
+}
+
+// Number of leading fields of a usage line's header list that match the
+// headers of job.
+int pch_common(const char *headers, struct pch_job *job) {
+    int count = 0;
+    while (*headers && count < job->count) {
+        size_t len = strcspn(headers, "\t\n");
+        if (len != strlen(job->headers[count]) || strncmp(headers, job->headers[count], len) != 0) {
+            break;
+        }
+        count++;
+        headers += len;
+        if (*headers == '\t') {
+            headers++;
+        }
+    }
+    return count;
+}
+
+// Stores the leading includes of the source under key in the usage file and
+// returns how many of them the PCH should take, or 0 for none. Call with
+// the group locked.
+int pch_choose(struct pch_job *job, const char *key) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    int counts[PCH_MAX_HEADERS + 1] = {0};
+    int limit = job->count;
+    char *data = NULL;
+    size_t size = 0;
+    struct stat st;
+
+    size_t line_len = strlen(key) + 2;
+    for (int i = 0; i < job->count; i++) {
+        line_len += strlen(job->headers[i]) + 1;
+    }
+    char *line = malloc(line_len + 1);
+    if (!line) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = snprintf(line, line_len + 1, "%s", key);
+    for (int i = 0; i < job->count; i++) {
+        n += snprintf(line + n, line_len + 1 - n, "\t%s", job->headers[i]);
+    }
+    snprintf(line + n, line_len + 1 - n, "\n");
+
+    if (snprintf(path, sizeof(path), "%s/usage", job->group) >= (int)sizeof(path)) {
+        free(line);
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = malloc(st.st_size + 1);
+        if (!data) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        ssize_t len = read(fd, data, st.st_size);
+        size = len > 0 ? len : 0;
+        data[size] = '\0';
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // Lines are "<source>\t<header>..." and "!\t<header>" for headers a
+    // prefix has to stop in front of.
+    int found = 0;
+    for (char *p = data; p && p < data + size; p = strchr(p, '\n') ? strchr(p, '\n') + 1 : data + size) {
+        size_t len = strcspn(p, "\n");
+        char *headers = memchr(p, '\t', len);
+        if (!headers) {
+            continue;
+        }
+        headers++;
+        if (headers - p == 2 && p[0] == '!') {
+            for (int i = 0; i < limit; i++) {
+                if (len - 2 == strlen(job->headers[i]) && strncmp(headers, job->headers[i], len - 2) == 0) {
+                    limit = i;
+                }
+            }
+            continue;
+        }
+        if ((size_t)(headers - p - 1) == strlen(key) && strncmp(p, key, headers - p - 1) == 0) {
+            found = len + 1 == strlen(line) && strncmp(p, line, len) == 0;
+            continue;
+        }
+        for (int i = pch_common(headers, job); i > 0; i--) {
+            counts[i]++;
+        }
+    }
+
+    if (!found && snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) < (int)sizeof(tmp)) {
+        fd = mkstemp(tmp);
+        FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (file) {
+            for (char *p = data; p && p < data + size; p = strchr(p, '\n') ? strchr(p, '\n') + 1 : data + size) {
+                size_t len = strcspn(p, "\n");
+                char *headers = memchr(p, '\t', len);
+                if (headers && (size_t)(headers - p) == strlen(key) && strncmp(p, key, headers - p) == 0) {
+                    continue;
+                }
+                fprintf(file, "%.*s\n", (int)len, p);
+            }
+            fputs(line, file);
+            if (fchmod(fd, 0644) != 0 || fclose(file) != 0 || rename(tmp, path) != 0) {
+                unlink(tmp);
+            }
+        } else if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+    }
+    free(data);
+    free(line);
+
+    int best = 0;
+    for (int i = 1; i <= limit; i++) {
+        counts[i]++;
+        if (counts[i] >= PCH_MIN_SOURCES && (!best || counts[i] * i > counts[best] * best)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Takes an flock on <dir>/.lock. Returns its fd, or -1 if it can't, or
+// someone else holds it and wait isn't set.
+int pch_lock(const char *dir, int wait) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.lock", dir);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void pch_unlock(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Keeps later prefixes in the group in front of header.
+void pch_reject(struct pch_job *job, const char *header) {
+    char path[PATH_MAX];
+    int lock = pch_lock(job->group, 1);
+    if (lock < 0) {
+        return;
+    }
+    int fits = snprintf(path, sizeof(path), "%s/usage", job->group) < (int)sizeof(path);
+    int fd = fits ? open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644) : -1;
+    if (fd >= 0) {
+        dprintf(fd, "!\t%s\n", header);
+        close(fd);
+    }
+    pch_unlock(lock);
+}
+
+// Returns 1 if the PCH in dir is current, 0 if it is missing and -1 if
+// it is stale.
+int pch_valid(const char *dir) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (snprintf(path, sizeof(path), "%s/" PCH_HEADER ".gch", dir) >= (int)sizeof(path) ||
+        stat(path, &st) != 0) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/interceptor-pch.deps", dir);
+    FILE *deps = fopen(path, "re");
+    if (!deps) {
+        return 0;
+    }
+    int valid = probe_valid(deps);
+    fclose(deps);
+    return valid ? 1 : -1;
+}
+
+// Writes a file of dir atomically.
+int pch_write(const char *dir, const char *name, const char *data) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path) ||
+        snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return -1;
+    }
+    int ok = write(fd, data, strlen(data)) == (ssize_t)strlen(data) && fchmod(fd, 0644) == 0;
+    if (close(fd) != 0 || !ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the index of the first of the first count headers of job that
+// names path, or count - 1 if none does.
+int pch_header_index(struct pch_job *job, int count, const char *path) {
+    size_t path_len = strlen(path);
+    for (int i = 0; i < count; i++) {
+        const char *name = job->headers[i] + 1;
+        size_t len = strlen(name) - 1;
+        if (path_len >= len && strncmp(path + path_len - len, name, len) == 0 &&
+            (path_len == len || path[path_len - len - 1] == '/')) {
+            return i;
+        }
+    }
+    return count - 1;
+}
+
+// Reads the -H output of a PCH build of the first count headers of job from
+// err, and forwards the diagnostics to stderr. Returns the index of the first
+// of the headers without an include guard, or count if all have one. Headers
+// that an earlier one includes already don't show up in the output, which is
+// fine: their guard kept them out.
+int pch_guards(struct pch_job *job, int count, int err) {
+    char *depth1[PCH_MAX_HEADERS];
+    char *line = NULL;
+    size_t size = 0;
+    int found = 0;
+    int guards = 0;
+    int first = count;
+
+    lseek(err, 0, SEEK_SET);
+    FILE *file = fdopen(dup(err), "r");
+    if (!file) {
+        return 0;
+    }
+    while (getline(&line, &size, file) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (guards) {
+            for (int i = 0; i < found; i++) {
+                int index = strings_equal(depth1[i], line) ? pch_header_index(job, count, line) : count;
+                first = index < first ? index : first;
+            }
+        } else if (strings_equal(line, PCH_GUARDS_LINE)) {
+            guards = 1;
+        } else if (line[0] == '.' && line[1] == ' ') {
+            if (found < PCH_MAX_HEADERS) {
+                depth1[found] = strdup(line + 2);
+                if (!depth1[found]) {
+                    perror("Memory allocation failed");
+                    exit(EXIT_FAILURE);
+                }
+                found++;
+            }
+        } else if (line[0] != '.') {
+            fprintf(stderr, "%s\n", line);
+        }
+    }
+    fclose(file);
+    free(line);
+    for (int i = 0; i < found; i++) {
+        free(depth1[i]);
+    }
+    return first;
+}
+
+// Builds the PCH of the first count headers of job in job->dir with the
+// flags of exec. Returns 0, or -1 if it can't be used.
+int pch_build(struct interceptor_exec *exec, char *envp[], struct pch_job *job, char *flags[], int flags_count,
+              int count) {
+    char header[PATH_MAX];
+    char gch[PATH_MAX];
+    char gch_tmp[PATH_MAX];
+    char dep_tmp[PATH_MAX];
+    char deps_tmp[PATH_MAX];
+    char path[PATH_MAX];
+
+    size_t size = 1;
+    for (int i = 0; i < count; i++) {
+        size += strlen(job->headers[i]) + 10;
+    }
+    char *data = exec_alloc(exec, size);
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += snprintf(data + len, size - len, "#include %s\n", job->headers[i]);
+    }
+    if (snprintf(header, sizeof(header), "%s/" PCH_HEADER, job->dir) >= (int)sizeof(header) ||
+        snprintf(gch, sizeof(gch), "%s.gch", header) >= (int)sizeof(gch) ||
+        snprintf(gch_tmp, sizeof(gch_tmp), "%s.XXXXXX", gch) >= (int)sizeof(gch_tmp) ||
+        snprintf(dep_tmp, sizeof(dep_tmp), "%s/interceptor-pch.d.XXXXXX", job->dir) >= (int)sizeof(dep_tmp)) {
+        return -1;
+    }
+    if (!file_exists(header) && pch_write(job->dir, PCH_HEADER, data) != 0) {
+        return -1;
+    }
+    int gch_fd = mkstemp(gch_tmp);
+    int dep_fd = mkstemp(dep_tmp);
+    int err = memfd_create("interceptor-pch", MFD_CLOEXEC);
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int status = -1;
+    if (gch_fd >= 0 && dep_fd >= 0 && err >= 0) {
+        char **argv = exec_alloc(exec, (flags_count + 12) * sizeof(char *));
+        memcpy(argv, flags, flags_count * sizeof(char *));
+        int argc = flags_count;
+        argv[argc++] = "-c";
+        argv[argc++] = "-H";
+        argv[argc++] = "-MD";
+        argv[argc++] = "-MF";
+        argv[argc++] = dep_tmp;
+        argv[argc++] = "-x";
+        argv[argc++] = (char *)job->lang;
+        argv[argc++] = header;
+        argv[argc++] = "-o";
+        argv[argc++] = gch_tmp;
+        argv[argc] = NULL;
+        interceptor_probing = 1;
+        status = run_child(exec->pathname, argv, envp, devnull, err);
+        interceptor_probing = 0;
+    }
+    int guarded = status == 0 ? pch_guards(job, count, err) : count - 1;
+    // Later prefixes stop in front of a header without a guard. One that
+    // doesn't compile on its own loses its last header.
+    if ((status == 0 && guarded < count) || (status > 0 && status < 128)) {
+        pch_reject(job, job->headers[guarded]);
+    }
+
+    int ok = status == 0 && guarded == count && fchmod(gch_fd, 0644) == 0 && rename(gch_tmp, gch) == 0;
+    if (ok) {
+        int fits = snprintf(path, sizeof(path), "%s/interceptor-pch.deps", job->dir) < (int)sizeof(path) &&
+                   snprintf(deps_tmp, sizeof(deps_tmp), "%s.XXXXXX", path) < (int)sizeof(deps_tmp);
+        int deps_fd = fits ? mkstemp(deps_tmp) : -1;
+        FILE *deps = deps_fd >= 0 ? fdopen(deps_fd, "w") : NULL;
+        if (deps) {
+            probe_record_depfile(deps, NULL, dep_tmp, header);
+        }
+        ok = deps && fchmod(deps_fd, 0644) == 0;
+        if (deps && (fclose(deps) != 0 || !ok || rename(deps_tmp, path) != 0)) {
+            ok = 0;
+        } else if (!deps && deps_fd >= 0) {
+            close(deps_fd);
+        }
+        if (!ok && deps_fd >= 0) {
+            unlink(deps_tmp);
+        }
+    } else if (gch_fd >= 0) {
+        unlink(gch_tmp);
+    }
+    if (gch_fd >= 0) {
+        close(gch_fd);
+    }
+    if (dep_fd >= 0) {
+        close(dep_fd);
+        unlink(dep_tmp);
+    }
+    if (err >= 0) {
+        close(err);
+    }
+    if (devnull >= 0) {
+        close(devnull);
+    }
+    return ok ? 0 : -1;
+}
+
+// The source of a single-source -c compile, like compile_source(), but
+// also of one with profile flags, which gcc doesn't check PCHs against.
+const char *pch_source(struct interceptor_exec *exec) {
+    int argc = 0;
+    while (exec->argv[argc]) {
+        argc++;
+    }
+    char **argv = exec_alloc(exec, (argc + 1) * sizeof(char *));
+    int count = 0;
+    for (int i = 0; i < argc; i++) {
+        if (i == 0 || !strings_equal_n(exec->argv[i], "-fprofile-")) {
+            argv[count++] = exec->argv[i];
+        }
+    }
+    argv[count] = NULL;
+    return compile_source(argv);
+}
+
+void pch_apply(struct interceptor_exec *exec, char *envp[]) {
+    struct pch_job job;
+    char key[PATH_MAX];
+    char name[64];
+
+    if (exec->rsp_fd >= 0 || !(job.source = pch_source(exec)) || pch_parse(exec, &job) != 0) {
+        return;
+    }
+    pch_scan(exec, &job);
+    if (!job.count || !realpath(job.source, key)) {
+        return;
+    }
+    int argc = 0;
+    while (exec->argv[argc]) {
+        argc++;
+    }
+    char **flags = exec_alloc(exec, (argc + 1) * sizeof(char *));
+    int flags_count = pch_flags(exec->argv, job.source, flags);
+    if (pch_group(exec, &job, flags, flags_count) != 0) {
+        return;
+    }
+    int lock = pch_lock(job.group, 1);
+    if (lock < 0) {
+        return;
+    }
+    int count = pch_choose(&job, key);
+    pch_unlock(lock);
+    if (!count) {
+        return;
+    }
+
+    size_t size = 1;
+    for (int i = 0; i < count; i++) {
+        size += strlen(job.headers[i]) + 1;
+    }
+    char *prefix = exec_alloc(exec, size);
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += snprintf(prefix + len, size - len, "%s\n", job.headers[i]);
+    }
+    snprintf(name, sizeof(name), "/%016llx", (unsigned long long)fnv1a(prefix, len));
+    if (snprintf(job.dir, sizeof(job.dir), "%s%s", job.group, name) >= (int)sizeof(job.dir) ||
+        (mkdir(job.dir, 0755) != 0 && !file_exists(job.dir))) {
+        return;
+    }
+    int valid = pch_valid(job.dir);
+    if (valid != 1) {
+        // One compile builds it; the others go on without it meanwhile.
+        lock = pch_lock(job.dir, 0);
+        if (lock < 0) {
+            pch_count(PCH_BUSY);
+            return;
+        }
+        valid = pch_valid(job.dir);
+        if (valid != 1) {
+            int built = pch_build(exec, envp, &job, flags, flags_count, count) == 0;
+            pch_count(!built ? PCH_FAILED : valid < 0 ? PCH_STALE : PCH_BUILT);
+            if (!built) {
+                pch_unlock(lock);
+                return;
+            }
+        }
+        pch_unlock(lock);
+    }
+
+    char **argv = exec_alloc(exec, (argc + 3) * sizeof(char *));
+    char *include = exec_alloc(exec, strlen(job.dir) + sizeof("/" PCH_HEADER));
+    sprintf(include, "%s/" PCH_HEADER, job.dir);
+    argv[0] = exec->argv[0];
+    argv[1] = "-include";
+    argv[2] = include;
+    memcpy(argv + 3, exec->argv + 1, argc * sizeof(char *));
+    exec->argv = argv;
+    if (exec->added) {
+        exec->added += 2;
+    }
+    pch_count(PCH_USED);
+}
+
+int add_pch(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    size_t len = strlen(path);
+    if (type == FTW_F && len > 4 && strings_equal(path + len - 4, ".gch")) {
+        pch_files++;
+        pch_bytes += (long long)st->st_blocks * 512;
+    }
+    return 0;
+}
+
+int pch_print_stats(void) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    long long values[PCH_STAT_COUNT];
+
+    if (state_file(dir, sizeof(dir), "pch") != 0 ||
+        snprintf(path, sizeof(path), "%s/stats", dir) >= (int)sizeof(path)) {
+        fprintf(stderr, "interceptor: invalid state directory\n");
+        return 1;
+    }
+    if (counters_read(path, pch_stat_names, values, PCH_STAT_COUNT) != 0) {
+        perror(path);
+        return 1;
+    }
+    printf("dir %s\n", dir);
+    for (int i = 0; i < PCH_STAT_COUNT; i++) {
+        printf("%s %lld\n", pch_stat_names[i], values[i]);
+    }
+    nftw(dir, add_pch, 16, FTW_PHYS);
+    printf("pchs %lld\n", pch_files);
+    printf("bytes %lld\n", pch_bytes);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef INTERCEPTOR_PCH_H
+#define INTERCEPTOR_PCH_H
+
+#include "rewrite.h"
+
+// Precompiled headers for the #include lines most sources of a directory
+// start with.
+
+// Nonzero if INTERCEPTOR_PCH asks for precompiled headers.
+int pch_enabled(void);
+
+// Records the leading includes of the compile in exec and, once enough
+// compiles with the same flags share them, makes exec -include a PCH of
+// them, building or rebuilding it first if needed. Leaves exec alone if it
+// isn't a single-source -c compile or no PCH fits.
+void pch_apply(struct interceptor_exec *exec, char *envp[]);
+
+// Prints the PCH counters for `interceptor pch-stats`.
+int pch_print_stats(void);
+
+#endif
@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgo.h"
+#include "util.h"
+
+// Layout of the PGO directory ($INTERCEPTOR_PGO_DIR, or
+// $INTERCEPTOR_STATE_DIR/pgo):
+//
+//   phase                   the phase set by `interceptor pgo-phase`
+//   stats                   counters since the last phase switch
+//   data/<object path>/     one directory per instrumented object
+//
+// gcc names the .gcda after the mangled object path, so each object
+// directory holds a single file, and both phases agree on it as long as the
+// build runs in the same place.
+
+#define PGO_GCOV_TOOL "/usr/bin/gcov-tool"
+
+extern char **environ;
+
+const char *const pgo_phase_names[] = {"off", "generate", "use", NULL};
+
+enum pgo_stat {
+    PGO_INSTRUMENTED,
+    PGO_PROFILED,
+    PGO_UNPROFILED,
+    PGO_STAT_COUNT,
+};
+
+const char *const pgo_stat_names[PGO_STAT_COUNT] = {"instrumented", "profiled", "unprofiled"};
+
+int pgo_file(char *path, size_t size, const char *name) {
+    const char *dir = getenv("INTERCEPTOR_PGO_DIR");
+    char state_name[64];
+    if (!dir || !*dir) {
+        snprintf(state_name, sizeof(state_name), "pgo/%s", name);
+        return state_file(path, size, state_name);
+    }
+    int len = snprintf(path, size, "%s/%s", dir, name);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+enum pgo_phase pgo_phase(void) {
+    const char *value = getenv("INTERCEPTOR_PGO");
+    char path[PATH_MAX];
+    char buf[16];
+
+    if (!value || !*value) {
+        if (pgo_file(path, sizeof(path), "phase") != 0) {
+            return PGO_OFF;
+        }
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return PGO_OFF;
+        }
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (len <= 0) {
+            return PGO_OFF;
+        }
+        buf[len] = '\0';
+        buf[strcspn(buf, "\n")] = '\0';
+        value = buf;
+    }
+    for (int i = 0; pgo_phase_names[i]; i++) {
+        if (strings_equal(value, pgo_phase_names[i])) {
+            return i;
+        }
+    }
+    return PGO_OFF;
+}
+
+// Execs with an arena aren't counted, since the counters are read with
+// stdio, which allocates.
+void pgo_count(struct interceptor_exec *exec, enum pgo_stat stat) {
+    char path[PATH_MAX];
+    long long deltas[PGO_STAT_COUNT] = {0};
+    deltas[stat] = 1;
+    if (!exec->arena && pgo_file(path, sizeof(path), "stats") == 0 && make_parents(path) == 0) {
+        counters_update(path, pgo_stat_names, deltas, NULL, PGO_STAT_COUNT);
+    }
+}
+
+// Maps an object file to its profile directory, data/<absolute object path>.
+int pgo_object_dir(const char *object, char *path, size_t size) {
+    char data[PATH_MAX];
+    char cwd[PATH_MAX];
+    int len;
+
+    if (pgo_file(data, sizeof(data), "data") != 0) {
+        return -1;
+    }
+    if (object[0] == '/') {
+        len = snprintf(path, size, "%s%s", data, object);
+    } else {
+        if (!getcwd(cwd, sizeof(cwd))) {
+            return -1;
+        }
+        len = snprintf(path, size, "%s%s/%s", data, strings_equal(cwd, "/") ? "" : cwd, object);
+    }
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the number of .gcda files in dir and adds their size to bytes.
+// Reads the directory with getdents64 rather than opendir, which allocates.
+int count_profiles(const char *path, long long *bytes) {
+    char buf[8192];
+    struct stat st;
+    int count = 0;
+    ssize_t n;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    while ((n = getdents64(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t offset = 0; offset < n;) {
+            struct dirent64 *ent = (struct dirent64 *)(buf + offset);
+            offset += ent->d_reclen;
+            size_t len = strlen(ent->d_name);
+            if (len < 5 || !strings_equal(ent->d_name + len - 5, ".gcda")) {
+                continue;
+            }
+            if (fstatat(fd, ent->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+                continue;
+            }
+            count++;
+            if (bytes) {
+                *bytes += st.st_size;
+            }
+        }
+    }
+    close(fd);
+    return count;
+}
+
+int add_pgo_flags(struct interceptor_exec *exec, enum pgo_phase phase, char *new_argv[], int new_argc, const char *object) {
+    char dir[PATH_MAX];
+
+    if (!object) {
+        // Instrumented objects need libgcov.
+        if (phase == PGO_GENERATE) {
+            new_argv[new_argc++] = "-fprofile-generate";
+        }
+        return new_argc;
+    }
+    if (pgo_object_dir(object, dir, sizeof(dir)) != 0) {
+        return new_argc;
+    }
+    if (phase == PGO_GENERATE) {
+        size_t size = strlen(dir) + 32;
+        char *flag = exec_alloc(exec, size);
+        snprintf(flag, size, "%s/", dir);
+        make_parents(flag);
+        snprintf(flag, size, "-fprofile-generate=%s", dir);
+        new_argv[new_argc++] = flag;
+        new_argv[new_argc++] = "-fprofile-update=prefer-atomic";
+        pgo_count(exec, PGO_INSTRUMENTED);
+    } else if (phase == PGO_USE) {
+        // Without a profile the object is built like outside PGO.
+        if (!count_profiles(dir, NULL)) {
+            pgo_count(exec, PGO_UNPROFILED);
+            return new_argc;
+        }
+        size_t size = strlen(dir) + 32;
+        char *flag = exec_alloc(exec, size);
+        snprintf(flag, size, "-fprofile-use=%s", dir);
+        new_argv[new_argc++] = flag;
+        new_argv[new_argc++] = "-fprofile-partial-training";
+        // Functions edited since training keep the static heuristics.
+        new_argv[new_argc++] = "-Wno-error=coverage-mismatch";
+        pgo_count(exec, PGO_PROFILED);
+    }
+    return new_argc;
+}
+
+int pgo_set_phase(const char *name) {
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    int phase = -1;
+
+    for (int i = 0; pgo_phase_names[i]; i++) {
+        if (strings_equal(name, pgo_phase_names[i])) {
+            phase = i;
+        }
+    }
+    if (phase < 0) {
+        fprintf(stderr, "interceptor: unknown PGO phase %s\n", name);
+        return 1;
+    }
+    if (pgo_file(path, sizeof(path), "phase") != 0 || make_parents(path) != 0 ||
+        snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+        perror("interceptor: PGO directory");
+        return 1;
+    }
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror(tmp);
+        return 1;
+    }
+    FILE *out = fdopen(fd, "w");
+    if (!out || fprintf(out, "%s\n", name) < 0 || fchmod(fd, 0644) != 0 ||
+        fclose(out) != 0 || rename(tmp, path) != 0) {
+        perror(path);
+        unlink(tmp);
+        return 1;
+    }
+    if (pgo_file(path, sizeof(path), "stats") == 0) {
+        unlink(path);
+    }
+    return 0;
+}
+
+typedef int (*pgo_visit)(const char *path, const char *object, void *arg);
+
+// Calls visit for every object directory under path, that is every directory
+// without subdirectories. root_len is the length of the data directory, so
+// path + root_len is the object path.
+int pgo_walk(char *path, size_t len, size_t root_len, pgo_visit visit, void *arg) {
+    DIR *dir = opendir(path);
+    struct dirent *ent;
+    struct stat st;
+    int leaf = 1;
+    int ret = 0;
+
+    if (!dir) {
+        return 0;
+    }
+    while ((ent = readdir(dir))) {
+        if (strings_equal(ent->d_name, ".") || strings_equal(ent->d_name, "..")) {
+            continue;
+        }
+        if (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        int n = snprintf(path + len, PATH_MAX - len, "/%s", ent->d_name);
+        if (n < 0 || (size_t)n >= PATH_MAX - len || stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            path[len] = '\0';
+            continue;
+        }
+        leaf = 0;
+        ret |= pgo_walk(path, len + n, root_len, visit, arg);
+        path[len] = '\0';
+    }
+    closedir(dir);
+    if (leaf && len > root_len) {
+        ret |= visit(path, path + root_len, arg);
+    }
+    return ret;
+}
+
+int copy_profiles(const char *src, const char *dst) {
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+    char buf[65536];
+    DIR *dir = opendir(src);
+    struct dirent *ent;
+    int ret = 0;
+
+    if (!dir) {
+        return -1;
+    }
+    while ((ent = readdir(dir))) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || !strings_equal(ent->d_name + len - 5, ".gcda")) {
+            continue;
+        }
+        snprintf(from, sizeof(from), "%s/%s", src, ent->d_name);
+        snprintf(to, sizeof(to), "%s/%s", dst, ent->d_name);
+        int in = open(from, O_RDONLY | O_CLOEXEC);
+        int out = in >= 0 ? open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+        ssize_t n = 0;
+        while (out >= 0 && (n = read(in, buf, sizeof(buf))) > 0) {
+            if (write(out, buf, n) != n) {
+                n = -1;
+                break;
+            }
+        }
+        if (in < 0 || out < 0 || n < 0) {
+            perror(to);
+            ret = -1;
+        }
+        if (in >= 0) {
+            close(in);
+        }
+        if (out >= 0) {
+            close(out);
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+int merge_object(const char *path, const char *object, void *arg) {
+    const char *gcov_tool = arg;
+    char dst[PATH_MAX];
+
+    if (!count_profiles(path, NULL)) {
+        return 0;
+    }
+    if (pgo_object_dir(object, dst, sizeof(dst)) != 0) {
+        return -1;
+    }
+    if (!count_profiles(dst, NULL)) {
+        size_t len = strlen(dst);
+        dst[len] = '/';
+        dst[len + 1] = '\0';
+        if (make_parents(dst) != 0) {
+            perror(dst);
+            return -1;
+        }
+        dst[len] = '\0';
+        return copy_profiles(path, dst);
+    }
+    char *argv[] = {"gcov-tool", "merge", "-o", dst, (char *)path, dst, NULL};
+    if (run_child(gcov_tool, argv, environ, -1, -1) != 0) {
+        fprintf(stderr, "interceptor: %s failed to merge %s\n", gcov_tool, path);
+        return -1;
+    }
+    return 0;
+}
+
+int pgo_merge(char *dirs[], int count) {
+    const char *gcov_tool = getenv("INTERCEPTOR_GCOV_TOOL");
+    char path[PATH_MAX];
+    int ret = 0;
+
+    if (!gcov_tool || !*gcov_tool) {
+        gcov_tool = PGO_GCOV_TOOL;
+    }
+    for (int i = 0; i < count; i++) {
+        int len = snprintf(path, sizeof(path), "%s/data", dirs[i]);
+        if (len < 0 || (size_t)len >= sizeof(path)) {
+            continue;
+        }
+        if (access(path, R_OK | X_OK) != 0) {
+            perror(path);
+            ret = 1;
+            continue;
+        }
+        if (pgo_walk(path, len, len, merge_object, (void *)gcov_tool) != 0) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+struct pgo_coverage {
+    int verbose;
+    long long objects;
+    long long profiled;
+    long long bytes;
+};
+
+int count_object(const char *path, const char *object, void *arg) {
+    struct pgo_coverage *coverage = arg;
+    coverage->objects++;
+    if (count_profiles(path, &coverage->bytes)) {
+        coverage->profiled++;
+    } else if (coverage->verbose) {
+        printf("unprofiled %s\n", object);
+    }
+    return 0;
+}
+
+int pgo_print_status(int verbose) {
+    struct pgo_coverage coverage = {verbose, 0, 0, 0};
+    long long values[PGO_STAT_COUNT];
+    char path[PATH_MAX];
+
+    printf("phase %s\n", pgo_phase_names[pgo_phase()]);
+    if (pgo_file(path, sizeof(path), "data") == 0) {
+        pgo_walk(path, strlen(path), strlen(path), count_object, &coverage);
+    }
+    printf("objects %lld\n", coverage.objects);
+    printf("profiled %lld (%.1f%%)\n", coverage.profiled,
+           coverage.objects ? 100.0 * coverage.profiled / coverage.objects : 0.0);
+    printf("profile_bytes %lld\n", coverage.bytes);
+    if (pgo_file(path, sizeof(path), "stats") == 0 &&
+        counters_read(path, pgo_stat_names, values, PGO_STAT_COUNT) == 0) {
+        for (int i = 0; i < PGO_STAT_COUNT; i++) {
+            printf("compiles_%s %lld\n", pgo_stat_names[i], values[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef INTERCEPTOR_PGO_H
+#define INTERCEPTOR_PGO_H
+
+#include "rewrite.h"
+
+// Two-phase profile-guided optimization.
+//
+// In the generate phase, every -c compile writes its profile to its own
+// directory under <pgo dir>/data, named after the absolute path of the
+// object; a command that compiles and links in one step uses the directory
+// of the program for all its sources. In the use phase, compiles whose
+// directory holds a .gcda read it.
+
+enum pgo_phase {
+    PGO_OFF,
+    PGO_GENERATE,
+    PGO_USE,
+};
+
+// The phase from INTERCEPTOR_PGO, or else from `interceptor pgo-phase`.
+enum pgo_phase pgo_phase(void);
+
+// Appends the PGO flags of the phase for a compile that writes object (or a
+// compile and link that writes the program object), or for a link of objects
+// only if object is NULL. Returns the new argc.
+int add_pgo_flags(struct interceptor_exec *exec, enum pgo_phase phase, char *new_argv[], int new_argc, const char *object);
+
+// `interceptor pgo-phase <off|generate|use>`
+int pgo_set_phase(const char *name);
+
+// `interceptor pgo-merge <pgo dir>...`: merges the profiles of other PGO
+// directories into this one with gcov-tool.
+int pgo_merge(char *dirs[], int count);
+
+// `interceptor pgo-status [-v]`: the phase and how many instrumented objects
+// have profile data. -v lists the objects without any.
+int pgo_print_status(int verbose);
+
+#endif
@@ -0,0 +1,511 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "probe.h"
+#include "rewrite.h"
+#include "rules.h"
+#include "sha256.h"
+#include "util.h"
+
+// Cache of configure probes, the compiles and links of conftest.* files that
+// autoconf runs by the thousand with the same sources and flags.
+//
+// The key hashes the compiler identity, the full argv, the environment the
+// driver reads and the contents of every input file. Entries live in
+// $INTERCEPTOR_STATE_DIR/probes/<first two hex digits>/<rest> as <rest>.meta,
+// plus <rest>.stdout, <rest>.stderr and <rest>.out (the object or executable)
+// when the probe produced them. The .meta goes last, so its presence means a
+// complete entry.
+//
+// A probe's result also depends on headers and libraries that the key can't
+// cover, such as a header that a newly installed package adds. The .meta lists
+// the headers the source included (from -MD), their directories, the system
+// include and library directories and the -I/-L directories of argv, with
+// their inode, size and mtime. A hit whose list no longer matches runs the
+// probe again.
+
+#define PROBE_VERSION "interceptor-probe-1"
+#define PROBE_MAX_DIRS 256
+
+enum probe_stat {
+    PROBE_HITS,
+    PROBE_MISSES,
+    PROBE_STALE,
+    PROBE_UNCACHEABLE,
+    PROBE_STAT_COUNT,
+};
+
+const char *const probe_stat_names[PROBE_STAT_COUNT] = {"hits", "misses", "stale", "uncacheable"};
+
+char *const probe_env_names[] = {
+    "COMPILER_PATH", "GCC_EXEC_PREFIX", "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH",
+    "OBJC_INCLUDE_PATH", "LIBRARY_PATH", "LANG", "LC_ALL", "LC_MESSAGES", NULL,
+};
+
+char *const probe_system_dirs[] = {
+    "/usr/include", "/usr/local/include", "/lib", "/lib64", "/usr/lib", "/usr/lib64", "/usr/local/lib", NULL,
+};
+
+// Options naming a directory the probe searches. Matched as prefixes.
+char *const probe_dir_options[] = {"-I", "-L", "-isystem", "-idirafter", "-iquote", NULL};
+
+struct probe_job {
+    const char *source; // the only source file, or NULL
+    const char *output; // the file the probe writes, or NULL for stdout
+    char output_buf[PATH_MAX];
+    char dir[PATH_MAX];
+    char entry[PATH_MAX];
+};
+
+struct probe_dirs {
+    char *paths[PROBE_MAX_DIRS];
+    int count;
+};
+
+int probe_cache_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_PROBE_CACHE");
+    return value && *value && !strings_equal(value, "0");
+}
+
+void probe_count(const char *dir, enum probe_stat stat) {
+    char path[PATH_MAX];
+    long long deltas[PROBE_STAT_COUNT] = {0};
+    deltas[stat] = 1;
+    if (snprintf(path, sizeof(path), "%s/stats", dir) < (int)sizeof(path)) {
+        counters_update(path, probe_stat_names, deltas, NULL, PROBE_STAT_COUNT);
+    }
+}
+
+// Finds the source and output of a conftest command. Returns -1 if it isn't
+// one, or it reads stdin, writes files besides its output or uses options
+// the key can't cover.
+int probe_parse(char *argv[], struct probe_job *job) {
+    int conftest = 0;
+    int compile = 0;
+    int assemble = 0;
+    int preprocess = 0;
+    int sources = 0;
+    const char *output = NULL;
+
+    job->source = NULL;
+    for (int i = 1; argv[i]; i++) {
+        const char *arg = argv[i];
+        if (strings_equal(arg, "-") || match_prefix_list(arg, cache_unsupported_options) ||
+            strings_equal_n(arg, "-M") || strings_equal_n(arg, "-Wp,-M")) {
+            return -1;
+        }
+        if (strings_equal(arg, "-c")) {
+            compile = 1;
+        } else if (strings_equal(arg, "-S")) {
+            assemble = 1;
+        } else if (strings_equal(arg, "-E")) {
+            preprocess = 1;
+        } else if (strings_equal(arg, "-o") && argv[i + 1]) {
+            output = argv[++i];
+            conftest |= strings_equal_n(get_basename(output, '/'), "conftest");
+        } else if (match_list(arg, cache_value_options) && argv[i + 1]) {
+            i++;
+        } else if (arg[0] != '-') {
+            conftest |= strings_equal_n(get_basename(arg, '/'), "conftest");
+            if (has_suffix(arg, source_suffixes)) {
+                job->source = arg;
+                sources++;
+            }
+        }
+    }
+    if (!conftest) {
+        return -1;
+    }
+    if (output || preprocess) {
+        job->output = output;
+    } else if (compile || assemble) {
+        if (sources != 1) {
+            return -1;
+        }
+        replace_suffix(job->output_buf, sizeof(job->output_buf), get_basename(job->source, '/'),
+                       compile ? ".o" : ".s");
+        job->output = job->output_buf;
+    } else {
+        job->output = "a.out";
+    }
+    if (sources != 1) {
+        job->source = NULL;
+    }
+    return 0;
+}
+
+int probe_key(char *pathname, char *argv[], char *envp[], struct probe_job *job) {
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    struct sha256 ctx;
+    struct stat st;
+
+    sha256_init(&ctx);
+    hash_string(&ctx, PROBE_VERSION);
+    if (stat(pathname, &st) != 0) {
+        return -1;
+    }
+    hash_string(&ctx, pathname);
+    sha256_update(&ctx, &st.st_size, sizeof(st.st_size));
+    sha256_update(&ctx, &st.st_mtim, sizeof(st.st_mtim));
+    for (int i = 0; argv[i]; i++) {
+        hash_string(&ctx, argv[i]);
+    }
+    for (int i = 0; probe_env_names[i]; i++) {
+        for (int j = 0; envp[j]; j++) {
+            if (strings_equal_n(envp[j], probe_env_names[i]) && envp[j][strlen(probe_env_names[i])] == '=') {
+                hash_string(&ctx, envp[j]);
+            }
+        }
+    }
+    for (int i = 1; argv[i]; i++) {
+        if (match_list(argv[i], cache_value_options) && argv[i + 1]) {
+            i++;
+            continue;
+        }
+        if (argv[i][0] == '-' || stat(argv[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || hash_fd(&ctx, fd) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        close(fd);
+    }
+    sha256_final(&ctx, digest);
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+    int len = snprintf(job->entry, sizeof(job->entry), "%s/%.2s/%s", job->dir, hex, hex + 2);
+    // Leaves room for the longest suffix of the entry's files.
+    if (len < 0 || (size_t)len + sizeof(".stderr") > sizeof(job->entry)) {
+        return -1;
+    }
+    return make_parents(job->entry);
+}
+
+void probe_record(FILE *meta, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    fprintf(meta, "dep %llu %lld %lld %ld %s\n", (unsigned long long)st.st_ino, (long long)st.st_size,
+            (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, path);
+}
+
+// Records dir unless it was recorded already.
+void probe_record_dir(FILE *meta, struct probe_dirs *dirs, const char *dir) {
+    for (int i = 0; i < dirs->count; i++) {
+        if (strings_equal(dirs->paths[i], dir)) {
+            return;
+        }
+    }
+    if (dirs->count < PROBE_MAX_DIRS) {
+        char *copy = strdup(dir);
+        if (!copy) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        dirs->paths[dirs->count++] = copy;
+    }
+    probe_record(meta, dir);
+}
+
+// Records every file of a make dependency file but source, and with dirs,
+// its directory too.
+void probe_record_depfile(FILE *meta, struct probe_dirs *dirs, const char *depfile, const char *source) {
+    char path[PATH_MAX];
+    int len = 0;
+    int target = 1;
+    int ch;
+    FILE *file = fopen(depfile, "re");
+    if (!file) {
+        return;
+    }
+    do {
+        ch = fgetc(file);
+        if (ch == '\\') {
+            int next = fgetc(file);
+            if (next == '\n') {
+                ch = ' ';
+            } else {
+                ch = next;
+                if (len + 1 < (int)sizeof(path)) {
+                    path[len++] = ch;
+                }
+                continue;
+            }
+        }
+        if (ch != EOF && ch != ' ' && ch != '\n' && ch != '\t') {
+            if (len + 1 < (int)sizeof(path)) {
+                path[len++] = ch;
+            }
+            continue;
+        }
+        path[len] = '\0';
+        if (len && target) {
+            target = path[len - 1] != ':';
+        } else if (len && !strings_equal(path, source)) {
+            probe_record(meta, path);
+            char *slash = strrchr(path, '/');
+            if (dirs && slash && slash != path) {
+                *slash = '\0';
+                probe_record_dir(meta, dirs, path);
+            }
+        }
+        len = 0;
+    } while (ch != EOF);
+    fclose(file);
+}
+
+// Records the directories the compiler and linker search.
+void probe_record_dirs(FILE *meta, struct probe_dirs *dirs, char *argv[]) {
+    char path[PATH_MAX];
+    struct utsname name;
+
+    for (int i = 0; probe_system_dirs[i]; i++) {
+        probe_record_dir(meta, dirs, probe_system_dirs[i]);
+    }
+    if (uname(&name) == 0) {
+        const char *const multiarch[] = {"/usr/include", "/usr/lib", "/lib", NULL};
+        for (int i = 0; multiarch[i]; i++) {
+            snprintf(path, sizeof(path), "%s/%s-linux-gnu", multiarch[i], name.machine);
+            probe_record_dir(meta, dirs, path);
+        }
+    }
+    for (int i = 1; argv[i]; i++) {
+        for (int j = 0; probe_dir_options[j]; j++) {
+            if (!strings_equal_n(argv[i], probe_dir_options[j])) {
+                continue;
+            }
+            const char *dir = argv[i] + strlen(probe_dir_options[j]);
+            if (!*dir) {
+                dir = argv[i + 1];
+            }
+            if (dir) {
+                probe_record_dir(meta, dirs, dir);
+            }
+            break;
+        }
+    }
+}
+
+// Nonzero if every path a .meta lists is unchanged.
+int probe_valid(FILE *meta) {
+    char line[PATH_MAX + 128];
+    struct stat st;
+    while (fgets(line, sizeof(line), meta)) {
+        unsigned long long ino;
+        long long size;
+        long long sec;
+        long nsec;
+        int offset;
+        if (sscanf(line, "dep %llu %lld %lld %ld %n", &ino, &size, &sec, &nsec, &offset) != 4) {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        if (stat(line + offset, &st) != 0) {
+            memset(&st, 0, sizeof(st));
+        }
+        if (st.st_ino != ino || st.st_size != size || st.st_mtim.tv_sec != sec || st.st_mtim.tv_nsec != nsec) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void probe_replay_file(const char *path, int fd) {
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in >= 0) {
+        copy_fd(in, fd);
+        close(in);
+    }
+}
+
+// Replays the entry of job. Returns the probe's exit status, or -1 on a miss.
+int probe_hit(struct probe_job *job) {
+    char path[PATH_MAX];
+    int status;
+    int has_output;
+
+    // probe_key() left room for the suffixes.
+    if (snprintf(path, sizeof(path), "%s.meta", job->entry) >= (int)sizeof(path)) {
+        return -1;
+    }
+    FILE *meta = fopen(path, "re");
+    if (!meta) {
+        return -1;
+    }
+    if (fscanf(meta, "status %d\noutput %d\n", &status, &has_output) != 2 || !probe_valid(meta)) {
+        fclose(meta);
+        probe_count(job->dir, PROBE_STALE);
+        return -1;
+    }
+    fclose(meta);
+    if (job->output) {
+        unlink(job->output);
+    }
+    if (has_output) {
+        if (!job->output || snprintf(path, sizeof(path), "%s.out", job->entry) >= (int)sizeof(path) ||
+            cache_restore(path, job->output) != 0) {
+            return -1;
+        }
+    }
+    if (snprintf(path, sizeof(path), "%s.stdout", job->entry) < (int)sizeof(path)) {
+        probe_replay_file(path, STDOUT_FILENO);
+    }
+    if (snprintf(path, sizeof(path), "%s.stderr", job->entry) < (int)sizeof(path)) {
+        probe_replay_file(path, STDERR_FILENO);
+    }
+    return status;
+}
+
+// Replays the temporary file tmp to fd, then moves it to the entry file with
+// suffix if it isn't empty.
+void probe_keep(int tmp_fd, const char *tmp, const char *entry, const char *suffix, int fd) {
+    char path[PATH_MAX];
+    lseek(tmp_fd, 0, SEEK_SET);
+    copy_fd(tmp_fd, fd);
+    snprintf(path, sizeof(path), "%s%s", entry, suffix);
+    // An empty file also replaces what a stale entry had.
+    if (lseek(tmp_fd, 0, SEEK_END) <= 0 || fchmod(tmp_fd, 0444) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        unlink(path);
+    }
+    close(tmp_fd);
+}
+
+int probe_exec(char *pathname, char *argv[], char *envp[]) {
+    struct probe_job job;
+    struct probe_dirs dirs = {{NULL}, 0};
+    char out_tmp[PATH_MAX];
+    char err_tmp[PATH_MAX];
+    char dep_tmp[PATH_MAX];
+    char meta_tmp[PATH_MAX];
+    char path[PATH_MAX];
+    struct stat st;
+
+    char tool[RULE_PATTERN_MAX];
+    if (rules_match(pathname, tool, sizeof(tool)) != ROLE_COMPILER || state_path(job.dir, sizeof(job.dir), "probes/") != 0) {
+        return -1;
+    }
+    job.dir[strlen(job.dir) - 1] = '\0';
+    if (probe_parse(argv, &job) != 0) {
+        return -1;
+    }
+    if (probe_key(pathname, argv, envp, &job) != 0) {
+        probe_count(job.dir, PROBE_UNCACHEABLE);
+        return -1;
+    }
+    int status = probe_hit(&job);
+    if (status >= 0) {
+        probe_count(job.dir, PROBE_HITS);
+        return status;
+    }
+
+    int argc = 0;
+    while (argv[argc]) {
+        argc++;
+    }
+    char **run_argv = malloc((argc + 4) * sizeof(char *));
+    if (!run_argv) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(run_argv, argv, argc * sizeof(char *));
+    int dep_fd = job.source ? open_tmp(job.dir, dep_tmp, sizeof(dep_tmp)) : -1;
+    if (dep_fd >= 0) {
+        close(dep_fd);
+        run_argv[argc++] = "-MD";
+        run_argv[argc++] = "-MF";
+        run_argv[argc++] = dep_tmp;
+    }
+    run_argv[argc] = NULL;
+
+    // Never write through a hardlink into the cache.
+    if (job.output) {
+        unlink(job.output);
+    }
+    int out = open_tmp(job.dir, out_tmp, sizeof(out_tmp));
+    int err = open_tmp(job.dir, err_tmp, sizeof(err_tmp));
+    status = run_child(pathname, run_argv, envp, out, err);
+    free(run_argv);
+
+    FILE *meta = NULL;
+    int meta_fd = status >= 0 && status < 128 && out >= 0 && err >= 0 ? open_tmp(job.dir, meta_tmp, sizeof(meta_tmp)) : -1;
+    if (meta_fd >= 0) {
+        meta = fdopen(meta_fd, "w");
+    }
+    if (meta) {
+        int has_output = 0;
+        if (job.output && stat(job.output, &st) == 0 && S_ISREG(st.st_mode)) {
+            has_output = snprintf(path, sizeof(path), "%s.out", job.entry) < (int)sizeof(path) &&
+                         cache_store(job.dir, job.output, path) >= 0;
+            if (has_output && (st.st_mode & 0111)) {
+                chmod(path, 0555);
+            }
+        }
+        fprintf(meta, "status %d\noutput %d\n", status, has_output);
+        if (job.source) {
+            probe_record_depfile(meta, &dirs, dep_tmp, job.source);
+        }
+        probe_record_dirs(meta, &dirs, argv);
+    }
+    if (dep_fd >= 0) {
+        unlink(dep_tmp);
+    }
+    if (out >= 0) {
+        probe_keep(out, out_tmp, job.entry, ".stdout", STDOUT_FILENO);
+    }
+    if (err >= 0) {
+        probe_keep(err, err_tmp, job.entry, ".stderr", STDERR_FILENO);
+    }
+    if (meta) {
+        if (snprintf(path, sizeof(path), "%s.meta", job.entry) >= (int)sizeof(path) || fchmod(meta_fd, 0444) != 0 || fclose(meta) != 0 || rename(meta_tmp, path) != 0) {
+            unlink(meta_tmp);
+        }
+    } else if (meta_fd >= 0) {
+        close(meta_fd);
+        unlink(meta_tmp);
+    }
+    for (int i = 0; i < dirs.count; i++) {
+        free(dirs.paths[i]);
+    }
+    probe_count(job.dir, PROBE_MISSES);
+    return status < 0 ? 1 : status;
+}
+
+int probe_print_stats(void) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    long long values[PROBE_STAT_COUNT];
+
+    if (state_file(dir, sizeof(dir), "probes") != 0 ||
+        snprintf(path, sizeof(path), "%s/stats", dir) >= (int)sizeof(path)) {
+        fprintf(stderr, "interceptor: invalid state directory\n");
+        return 1;
+    }
+    if (counters_read(path, probe_stat_names, values, PROBE_STAT_COUNT) != 0) {
+        perror(path);
+        return 1;
+    }
+    printf("dir %s\n", dir);
+    for (int i = 0; i < PROBE_STAT_COUNT; i++) {
+        printf("%s %lld\n", probe_stat_names[i], values[i]);
+    }
+    long long lookups = values[PROBE_HITS] + values[PROBE_MISSES];
+    printf("hit_rate %.1f\n", lookups ? 100.0 * values[PROBE_HITS] / lookups : 0.0);
+    return 0;
+}
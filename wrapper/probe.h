@@ -0,0 +1,25 @@
+#ifndef INTERCEPTOR_PROBE_H
+#define INTERCEPTOR_PROBE_H
+
+#include <stdio.h>
+
+// Memoizes configure probes: compiles and links of conftest files.
+
+// Nonzero if INTERCEPTOR_PROBE_CACHE asks for the probe cache.
+int probe_cache_enabled(void);
+
+// Runs the compiler command pathname argv through the probe cache, replaying
+// the exit status, stdout, stderr and output of an identical earlier probe.
+// Returns the exit status, or -1 if the command isn't a cacheable probe and
+// should be exec'd as usual.
+int probe_exec(char *pathname, char *argv[], char *envp[]);
+
+// Also used by the PCH cache to revalidate precompiled headers.
+struct probe_dirs;
+void probe_record_depfile(FILE *meta, struct probe_dirs *dirs, const char *depfile, const char *source);
+int probe_valid(FILE *meta);
+
+// Prints the probe cache counters for `interceptor probe-stats`.
+int probe_print_stats(void);
+
+#endif
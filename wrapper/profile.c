@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "rewrite.h"
+
+// Config syntax, one directive per line, '#' starts a comment:
+//
+//   profile <name> [lto] <flag>...
+//   use <profile> <dir> [compiler]
+//
+// `use` selects a profile for compiles run under dir (after resolving
+// symlinks), optionally only for one compiler, by the tool name the rules
+// give it (gcc for gcc-12, or clang). The longest dir wins, and a rule for a
+// specific compiler wins over one for any compiler. A profile named
+// "default" applies wherever no rule does.
+
+const struct profile_header *profile_table;
+
+// Nonzero if off starts a string that ends inside table.
+int profile_string_valid(const struct profile_header *table, uint32_t off) {
+    return off < table->size && memchr((const char *)table + off, '\0', table->size - off);
+}
+
+// Checks every offset in table once, so that lookups can follow them without
+// bounds checks. table->size must be the size of the mapping.
+int profile_table_valid(const struct profile_header *table) {
+    const char *base = (const char *)table;
+    if (table->magic != PROFILE_MAGIC || table->version != PROFILE_VERSION ||
+        table->profiles % sizeof(uint32_t) || table->profiles > table->size ||
+        table->nr_profiles > (table->size - table->profiles) / sizeof(struct profile_entry) ||
+        table->rules % sizeof(uint32_t) || table->rules > table->size ||
+        table->nr_rules > (table->size - table->rules) / sizeof(struct profile_rule)) {
+        return 0;
+    }
+    const struct profile_entry *profiles = (const struct profile_entry *)(base + table->profiles);
+    for (uint32_t i = 0; i < table->nr_profiles; i++) {
+        const struct profile_entry *entry = &profiles[i];
+        if (!profile_string_valid(table, entry->name) || entry->flags % sizeof(uint32_t) ||
+            entry->flags > table->size || entry->nr_flags > (table->size - entry->flags) / sizeof(uint32_t)) {
+            return 0;
+        }
+        const uint32_t *flags = (const uint32_t *)(base + entry->flags);
+        for (uint32_t j = 0; j < entry->nr_flags; j++) {
+            if (!profile_string_valid(table, flags[j])) {
+                return 0;
+            }
+        }
+    }
+    const struct profile_rule *rules = (const struct profile_rule *)(base + table->rules);
+    for (uint32_t i = 0; i < table->nr_rules; i++) {
+        const struct profile_rule *rule = &rules[i];
+        if ((rule->compiler && !profile_string_valid(table, rule->compiler)) ||
+            !profile_string_valid(table, rule->dir) || strlen(base + rule->dir) != rule->dir_len ||
+            rule->profile >= table->nr_profiles) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Maps the table once per process: open, fstat, mmap and close, plus a
+// getcwd() per lookup if a rule has a directory. The wrapper pays that on
+// every compile instead of parsing a config; the preload library keeps the
+// mapping. Without a table it costs the one failed open.
+const struct profile_header *profile_map(void) {
+    const char *path = getenv("INTERCEPTOR_PROFILES");
+    struct stat st;
+
+    if (profile_table) {
+        return profile_table;
+    }
+    if (!path || !*path) {
+        path = PROFILE_TABLE_PATH;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct profile_header) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return NULL;
+    }
+    const struct profile_header *table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        return NULL;
+    }
+    if (table->size != st.st_size || !profile_table_valid(table)) {
+        munmap((void *)table, st.st_size);
+        return NULL;
+    }
+    // The preload library may race here; the loser just unmaps its copy.
+    const struct profile_header *expected = NULL;
+    if (!__atomic_compare_exchange_n(&profile_table, &expected, table, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap((void *)table, st.st_size);
+        return expected;
+    }
+    return table;
+}
+
+int profile_lookup(const char *compiler, struct profile *profile) {
+    const struct profile_header *table = profile_map();
+    char cwd[PATH_MAX];
+
+    if (!table) {
+        return -1;
+    }
+    const char *base = (const char *)table;
+    const struct profile_rule *rules = (const struct profile_rule *)(base + table->rules);
+    const struct profile_entry *profiles = (const struct profile_entry *)(base + table->profiles);
+    if (table->has_dirs && !getcwd(cwd, sizeof(cwd))) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < table->nr_rules; i++) {
+        const struct profile_rule *rule = &rules[i];
+        if (rule->compiler && !strings_equal(base + rule->compiler, compiler)) {
+            continue;
+        }
+        if (rule->dir_len && (strncmp(cwd, base + rule->dir, rule->dir_len) != 0 ||
+                              (cwd[rule->dir_len] && cwd[rule->dir_len] != '/'))) {
+            continue;
+        }
+        const struct profile_entry *entry = &profiles[rule->profile];
+        profile->base = base;
+        profile->flags = (const uint32_t *)(base + entry->flags);
+        profile->nr_flags = entry->nr_flags;
+        profile->options = entry->options;
+        return 0;
+    }
+    return -1;
+}
+
+// Profile compiler
+
+struct source_profile {
+    char *name;
+    int options;
+    char **flags;
+    int nr_flags;
+};
+
+struct source_rule {
+    char *dir;
+    char *compiler;
+    int profile;
+    int line;
+};
+
+struct strings {
+    char *data;
+    size_t size;
+};
+
+uint32_t strings_add(struct strings *strings, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *data = realloc(strings->data, strings->size + len);
+    if (!data) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(data + strings->size, str, len);
+    strings->data = data;
+    strings->size += len;
+    return strings->size - len;
+}
+
+void *grow(void *array, int count, size_t size) {
+    array = realloc(array, (count + 1) * size);
+    if (!array) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+int compare_rules(const void *a, const void *b) {
+    const struct source_rule *x = a;
+    const struct source_rule *y = b;
+    size_t x_len = strlen(x->dir);
+    size_t y_len = strlen(y->dir);
+    if (x_len != y_len) {
+        return x_len > y_len ? -1 : 1;
+    }
+    if (!x->compiler != !y->compiler) {
+        return x->compiler ? -1 : 1;
+    }
+    return x->line - y->line;
+}
+
+int find_profile(struct source_profile *profiles, int nr_profiles, const char *name) {
+    for (int i = 0; i < nr_profiles; i++) {
+        if (strings_equal(profiles[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int profile_compile(const char *input, const char *output) {
+    struct source_profile *profiles = NULL;
+    struct source_rule *rules = NULL;
+    int nr_profiles = 0;
+    int nr_rules = 0;
+    int nr_flags = 0;
+    int has_default_rule = 0;
+    char line[65536];
+    int line_no = 0;
+
+    FILE *file = fopen(input, "re");
+    if (!file) {
+        perror(input);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char *save;
+        line_no++;
+        *strchrnul(line, '#') = '\0';
+        char *directive = strtok_r(line, " \t\r\n", &save);
+        if (!directive) {
+            continue;
+        }
+        char *name = strtok_r(NULL, " \t\r\n", &save);
+        if (!name) {
+            fprintf(stderr, "%s:%d: missing profile name\n", input, line_no);
+            return 1;
+        }
+        if (strings_equal(directive, "profile")) {
+            if (find_profile(profiles, nr_profiles, name) >= 0) {
+                fprintf(stderr, "%s:%d: profile %s defined twice\n", input, line_no, name);
+                return 1;
+            }
+            profiles = grow(profiles, nr_profiles, sizeof(*profiles));
+            struct source_profile *profile = &profiles[nr_profiles++];
+            profile->name = strdup(name);
+            profile->options = 0;
+            profile->flags = NULL;
+            profile->nr_flags = 0;
+            for (char *flag; (flag = strtok_r(NULL, " \t\r\n", &save));) {
+                if (strings_equal(flag, "lto") && !profile->nr_flags) {
+                    profile->options |= PROFILE_LTO;
+                    continue;
+                }
+                profile->flags = grow(profile->flags, profile->nr_flags, sizeof(char *));
+                profile->flags[profile->nr_flags++] = strdup(flag);
+                nr_flags++;
+            }
+        } else if (strings_equal(directive, "use")) {
+            char *dir = strtok_r(NULL, " \t\r\n", &save);
+            char *compiler = strtok_r(NULL, " \t\r\n", &save);
+            char resolved[PATH_MAX];
+            if (!dir || dir[0] != '/' || strtok_r(NULL, " \t\r\n", &save)) {
+                fprintf(stderr, "%s:%d: expected use <profile> <absolute dir> [compiler]\n", input, line_no);
+                return 1;
+            }
+            if (realpath(dir, resolved)) {
+                dir = resolved;
+            }
+            size_t len = strlen(dir);
+            while (len && dir[len - 1] == '/') {
+                dir[--len] = '\0';
+            }
+            rules = grow(rules, nr_rules, sizeof(*rules));
+            rules[nr_rules].dir = strdup(dir);
+            rules[nr_rules].compiler = compiler ? strdup(compiler) : NULL;
+            rules[nr_rules].profile = find_profile(profiles, nr_profiles, name);
+            rules[nr_rules].line = line_no;
+            if (rules[nr_rules].profile < 0) {
+                fprintf(stderr, "%s:%d: unknown profile %s\n", input, line_no, name);
+                return 1;
+            }
+            if (!len && !compiler) {
+                has_default_rule = 1;
+            }
+            nr_rules++;
+        } else {
+            fprintf(stderr, "%s:%d: unknown directive %s\n", input, line_no, directive);
+            return 1;
+        }
+    }
+    fclose(file);
+
+    int default_profile = find_profile(profiles, nr_profiles, "default");
+    if (default_profile >= 0 && !has_default_rule) {
+        rules = grow(rules, nr_rules, sizeof(*rules));
+        rules[nr_rules].dir = "";
+        rules[nr_rules].compiler = NULL;
+        rules[nr_rules].profile = default_profile;
+        rules[nr_rules].line = line_no + 1;
+        nr_rules++;
+    }
+    qsort(rules, nr_rules, sizeof(*rules), compare_rules);
+
+    // Header, profiles, rules, flag offsets, then strings.
+    struct strings strings = {NULL, 0};
+    struct profile_header header = {PROFILE_MAGIC, PROFILE_VERSION, 0, nr_profiles, 0, nr_rules, 0, 0};
+    header.profiles = sizeof(header);
+    header.rules = header.profiles + nr_profiles * sizeof(struct profile_entry);
+    uint32_t flags_base = header.rules + nr_rules * sizeof(struct profile_rule);
+    uint32_t strings_base = flags_base + nr_flags * sizeof(uint32_t);
+    struct profile_entry *entries = calloc(nr_profiles + 1, sizeof(*entries));
+    struct profile_rule *table_rules = calloc(nr_rules + 1, sizeof(*table_rules));
+    uint32_t *flags = calloc(nr_flags + 1, sizeof(*flags));
+    if (!entries || !table_rules || !flags) {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    for (int i = 0, flag = 0; i < nr_profiles; i++) {
+        entries[i].name = strings_base + strings_add(&strings, profiles[i].name);
+        entries[i].options = profiles[i].options;
+        entries[i].nr_flags = profiles[i].nr_flags;
+        entries[i].flags = flags_base + flag * sizeof(uint32_t);
+        for (int j = 0; j < profiles[i].nr_flags; j++) {
+            flags[flag++] = strings_base + strings_add(&strings, profiles[i].flags[j]);
+        }
+    }
+    for (int i = 0; i < nr_rules; i++) {
+        table_rules[i].dir = strings_base + strings_add(&strings, rules[i].dir);
+        table_rules[i].dir_len = strlen(rules[i].dir);
+        table_rules[i].compiler = rules[i].compiler ? strings_base + strings_add(&strings, rules[i].compiler) : 0;
+        table_rules[i].profile = rules[i].profile;
+        if (table_rules[i].dir_len) {
+            header.has_dirs = 1;
+        }
+    }
+    header.size = strings_base + strings.size;
+
+    // Replace the table atomically; running wrappers keep their mapping.
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", output);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror(tmp);
+        return 1;
+    }
+    FILE *out = fdopen(fd, "w");
+    if (!out ||
+        fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(entries, sizeof(*entries), nr_profiles, out) != (size_t)nr_profiles ||
+        fwrite(table_rules, sizeof(*table_rules), nr_rules, out) != (size_t)nr_rules ||
+        fwrite(flags, sizeof(*flags), nr_flags, out) != (size_t)nr_flags ||
+        fwrite(strings.data, 1, strings.size, out) != strings.size ||
+        fchmod(fd, 0644) != 0 || fclose(out) != 0 || rename(tmp, output) != 0) {
+        perror(output);
+        unlink(tmp);
+        return 1;
+    }
+    printf("%s: %d profiles, %d rules, %u bytes\n", output, nr_profiles, nr_rules, header.size);
+    return 0;
+}
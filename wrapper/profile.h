@@ -0,0 +1,62 @@
+#ifndef INTERCEPTOR_PROFILE_H
+#define INTERCEPTOR_PROFILE_H
+
+#include <stdint.h>
+
+// Compiled flag profiles.
+//
+// `interceptor profile-compile` turns a text config into a table that the
+// wrapper maps read-only and uses as is. Everything in the table is an offset
+// from its start, so it works at any address.
+
+#define PROFILE_TABLE_PATH "/etc/interceptor/profiles.bin"
+#define PROFILE_MAGIC 0x46505449 // "ITPF"
+#define PROFILE_VERSION 1
+
+#define PROFILE_LTO 1
+
+struct profile_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t nr_profiles;
+    uint32_t profiles; // struct profile_entry[nr_profiles]
+    uint32_t nr_rules;
+    uint32_t rules;    // struct profile_rule[nr_rules], most specific first
+    uint32_t has_dirs; // nonzero if any rule needs the working directory
+};
+
+struct profile_entry {
+    uint32_t name;
+    uint32_t options; // PROFILE_*
+    uint32_t nr_flags;
+    uint32_t flags; // uint32_t[nr_flags] of string offsets
+};
+
+struct profile_rule {
+    uint32_t dir;     // without a trailing slash; "" matches everything
+    uint32_t dir_len;
+    uint32_t compiler; // 0 matches any compiler
+    uint32_t profile;  // index into the profiles
+};
+
+struct profile {
+    const char *base;
+    const uint32_t *flags;
+    int nr_flags;
+    int options;
+};
+
+// Finds the profile for compiler (the tool name rules_match() gives, such as
+// "gcc", "g++" or "clang") in the working directory. Returns -1 if there is no table
+// or no rule applies.
+int profile_lookup(const char *compiler, struct profile *profile);
+
+static inline const char *profile_flag(const struct profile *profile, int i) {
+    return profile->base + profile->flags[i];
+}
+
+// Compiles the text config input into the table output.
+int profile_compile(const char *input, const char *output);
+
+#endif
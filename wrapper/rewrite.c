@@ -0,0 +1,817 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "debuginfo.h"
+#include "linker.h"
+#include "native.h"
+#include "pgo.h"
+#include "profile.h"
+#include "rewrite.h"
+#include "rules.h"
+#include "toolindex.h"
+
+#define MAX_NEW_ARGV 48
+#define LTO_PLUGIN_PATH "/usr/lib/bfd-plugins/liblto_plugin.so"
+// Links with less LTO input than this keep a single whole-program LTRANS.
+#define LTO_SMALL_LINK_BYTES (16LL << 20)
+#define LTO_PARTITION_BYTES (8LL << 20)
+#define LTO_MAX_PARTITIONS 128
+#define RSP_MAX_DEPTH 16
+// Expanded command lines longer than this reach gcc through a response file.
+#define RSP_INLINE_BYTES (64 * 1024)
+
+char *const gcc_compiler_list[] = {"gcc", "g++", "c++", "cc", "xgcc", "xg++", NULL};
+
+char *const source_suffixes[] = {
+    ".c", ".cc", ".cp", ".cxx", ".cpp", ".CPP", ".c++", ".C", ".i", ".ii", ".S", ".sx", ".m", ".mi", ".mm", ".M", ".mii", NULL,
+};
+char *const binutils_list[] = {"ar", "nm", "ranlib", NULL};
+char *const binutils_new_list[] = {"nm-new", NULL};
+
+// Appended to compiler command lines when no compiled profile applies.
+char *const default_profile_flags[] = {
+    "-pipe",
+    "-Wno-error",
+    "-O3",
+    "-fgraphite-identity",
+    "-floop-nest-optimize",
+    "-fipa-pta",
+    "-fno-semantic-interposition",
+    "-fno-common",
+    "-fdevirtualize-at-ltrans",
+    "-fno-plt",
+    "-ffunction-sections",
+    "-fdata-sections",
+    "-mtls-dialect=gnu2",
+    "-malign-data=cacheline",
+    "-Wl,-O2",
+    "-Wl,--gc-sections",
+    NULL,
+};
+
+int strings_equal(const char *str1, const char *str2) {
+    if (strcmp(str1, str2) == 0) {
+        return 1;
+    }
+    return 0;
+}
+
+int strings_equal_n(const char *str1, const char *str2) {
+    if (strncmp(str1, str2, strlen(str2)) == 0) {
+        return 1;
+    }
+    return 0;
+}
+
+int match_list(const char *str, char *const list[]) {
+    for (int i = 0; list[i]; i++) {
+        if (strings_equal(str, list[i])) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+int has_suffix(const char *str, char *const list[]) {
+    const char *dot = strrchr(str, '.');
+    for (int i = 0; dot && list[i]; i++) {
+        if (strings_equal(dot, list[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void replace_suffix(char *buf, size_t size, const char *path, const char *suffix) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    int len = dot && (!slash || dot > slash) ? dot - path : (int)strlen(path);
+    snprintf(buf, size, "%.*s%s", len, path, suffix);
+}
+
+char *insert_wrapper(struct interceptor_exec *exec, const char *str1, const char *str2, int index) {
+    int str1_len = strlen(str1);
+    int new_len = str1_len + strlen(str2) + 1;
+    int insert_pos = str1_len - strlen(binutils_list[index - 1]);
+    char *res = exec_alloc(exec, new_len);
+    memset(res, '\0', new_len);
+    strncpy(res, str1, insert_pos);
+    strcat(res, str2);
+    strcat(res, str1 + insert_pos);
+
+    return res;
+}
+
+char *get_basename(const char *path, const char delimiter) {
+    char *last_char = strrchr(path, delimiter);
+    if (last_char) {
+        return last_char + 1;
+    }
+    return (char *)path;
+}
+
+int file_exists(const char *path) {
+    int res = 0;
+    if (access(path, R_OK) == 0) {
+        res |= 4;
+    }
+    // if (access(path, W_OK) == 0) {
+    //     res |= 2;
+    // }
+    if (access(path, X_OK) == 0) {
+        res |= 1;
+    }
+    return res;
+}
+
+struct exec_allocation {
+    struct exec_allocation *next;
+    void *ptr;
+    size_t map_size; // nonzero if ptr is a mapping
+};
+
+void *exec_own(struct interceptor_exec *exec, void *ptr) {
+    struct exec_allocation *allocation = malloc(sizeof(*allocation));
+    if (!ptr || !allocation) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    allocation->ptr = ptr;
+    allocation->map_size = 0;
+    allocation->next = exec->allocations;
+    exec->allocations = allocation;
+    return ptr;
+}
+
+void *exec_alloc(struct interceptor_exec *exec, size_t size) {
+    struct exec_arena *arena = exec->arena;
+    if (!arena) {
+        return exec_own(exec, malloc(size));
+    }
+    size_t offset = (arena->used + 15) & ~(size_t)15;
+    if (offset > arena->size || size > arena->size - offset) {
+        longjmp(arena->full, 1);
+    }
+    arena->used = offset + size;
+    return arena->data + offset;
+}
+
+void interceptor_exec_release(struct interceptor_exec *exec) {
+    while (exec->allocations) {
+        struct exec_allocation *next = exec->allocations->next;
+        if (exec->allocations->map_size) {
+            munmap(exec->allocations->ptr, exec->allocations->map_size);
+        } else {
+            free(exec->allocations->ptr);
+        }
+        free(exec->allocations);
+        exec->allocations = next;
+    }
+    if (exec->rsp_fd >= 0) {
+        close(exec->rsp_fd);
+        exec->rsp_fd = -1;
+    }
+}
+
+// Compiler arguments are classified in one pass over their characters by a
+// trie of the patterns below, built once at startup.
+
+enum arg_class {
+    ARG_KEEP,
+    ARG_PROBE,   // version queries: run the command unchanged
+    ARG_STRIP,   // replaced by the wrapper's own flags
+    ARG_NO_LINK, // stops before the link
+    ARG_OUTPUT,  // takes the output file as the next argument
+};
+
+struct arg_pattern {
+    const char *pattern;
+    int prefix;
+    enum arg_class class;
+};
+
+const struct arg_pattern arg_patterns[] = {
+    {"-v", 0, ARG_PROBE},
+    {"-V", 0, ARG_PROBE},
+    {"--version", 0, ARG_PROBE},
+    {"-qversion", 0, ARG_PROBE},
+    {"-O", 1, ARG_STRIP},
+    {"-Ofast", 0, ARG_KEEP},
+    {"-march=", 1, ARG_STRIP},
+    {"-mtune=", 1, ARG_STRIP},
+    {"-c", 0, ARG_NO_LINK},
+    {"-S", 0, ARG_NO_LINK},
+    {"-E", 0, ARG_NO_LINK},
+    {"-M", 0, ARG_NO_LINK},
+    {"-MM", 0, ARG_NO_LINK},
+    {"-o", 0, ARG_OUTPUT},
+    {NULL, 0, ARG_KEEP},
+};
+
+#define ARG_TRIE_NODES 128
+
+// Children form a sibling list; index 0 is the root, so 0 also means none.
+struct arg_trie_node {
+    char ch;
+    unsigned char exact;  // class + 1 if a pattern ends here
+    unsigned char prefix; // class + 1 if a prefix pattern ends here
+    unsigned char child;
+    unsigned char sibling;
+};
+
+struct arg_trie_node arg_trie[ARG_TRIE_NODES];
+int arg_trie_size = 1;
+
+__attribute__((constructor)) void arg_trie_build(void) {
+    for (int i = 0; arg_patterns[i].pattern; i++) {
+        int node = 0;
+        for (const char *p = arg_patterns[i].pattern; *p; p++) {
+            int child = arg_trie[node].child;
+            while (child && arg_trie[child].ch != *p) {
+                child = arg_trie[child].sibling;
+            }
+            if (!child) {
+                child = arg_trie_size++;
+                arg_trie[child].ch = *p;
+                arg_trie[child].sibling = arg_trie[node].child;
+                arg_trie[node].child = child;
+            }
+            node = child;
+        }
+        if (arg_patterns[i].prefix) {
+            arg_trie[node].prefix = arg_patterns[i].class + 1;
+        } else {
+            arg_trie[node].exact = arg_patterns[i].class + 1;
+        }
+    }
+}
+
+// Returns the class of the exact pattern equal to arg, or else of the longest
+// prefix pattern of arg.
+enum arg_class classify_arg(const char *arg) {
+    enum arg_class res = ARG_KEEP;
+    int node = 0;
+    for (const char *p = arg;; p++) {
+        if (arg_trie[node].prefix) {
+            res = arg_trie[node].prefix - 1;
+        }
+        if (!*p) {
+            return arg_trie[node].exact ? (enum arg_class)(arg_trie[node].exact - 1) : res;
+        }
+        int child = arg_trie[node].child;
+        while (child && arg_trie[child].ch != *p) {
+            child = arg_trie[child].sibling;
+        }
+        if (!child) {
+            return res;
+        }
+        node = child;
+    }
+}
+
+struct arg_list {
+    char **argv;
+    int argc;
+    int capacity;
+};
+
+void arg_list_push(struct interceptor_exec *exec, struct arg_list *list, char *arg) {
+    if (list->argc == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        char **argv = exec_alloc(exec, list->capacity * sizeof(char *));
+        if (list->argc) {
+            memcpy(argv, list->argv, list->argc * sizeof(char *));
+        }
+        list->argv = argv;
+    }
+    list->argv[list->argc++] = arg;
+}
+
+// Appends the arguments of response file path to list, with gcc's quoting:
+// whitespace separates arguments, quotes group them and a backslash escapes
+// any character. Nested @files are expanded too. Returns -1 if path can't be
+// read, in which case gcc keeps the argument as is.
+int expand_response_file(struct interceptor_exec *exec, struct arg_list *list, const char *path, int depth) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    // Unquoting never makes an argument longer, so the arguments are
+    // unquoted in place, in a private mapping. The terminator of the last
+    // argument may land one byte past the file, in the zeroed tail of its
+    // last page. A file that fills its last page, or a vfork child, whose
+    // mappings would outlive it in the parent, reads into memory instead.
+    char *data = NULL;
+    off_t len = st.st_size;
+    if (!exec->arena && st.st_size % sysconf(_SC_PAGESIZE) != 0) {
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            exec_own(exec, data);
+            exec->allocations->map_size = st.st_size;
+        }
+    }
+    if (!data) {
+        data = exec_alloc(exec, st.st_size + 1);
+        len = 0;
+        ssize_t n = 1;
+        while (len < st.st_size && (n = read(fd, data + len, st.st_size - len)) > 0) {
+            len += n;
+        }
+        if (n < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    char *out = data;
+    const char *p = data;
+    const char *end = data + len;
+    while (1) {
+        while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        char *arg = out;
+        char quote = 0;
+        int escaped = 0;
+        for (; p < end; p++) {
+            if (escaped) {
+                escaped = 0;
+                *out++ = *p;
+            } else if (*p == '\\') {
+                escaped = 1;
+            } else if (quote) {
+                if (*p == quote) {
+                    quote = 0;
+                } else {
+                    *out++ = *p;
+                }
+            } else if (*p == ' ' || (*p >= '\t' && *p <= '\r')) {
+                break;
+            } else if (*p == '\'' || *p == '"') {
+                quote = *p;
+            } else {
+                *out++ = *p;
+            }
+        }
+        // Past the separator, which the terminator may overwrite.
+        if (p < end) {
+            p++;
+        }
+        *out++ = '\0';
+        if (arg[0] == '@' && depth < RSP_MAX_DEPTH &&
+            expand_response_file(exec, list, arg + 1, depth + 1) == 0) {
+            continue;
+        }
+        arg_list_push(exec, list, arg);
+    }
+    return 0;
+}
+
+// Returns argv with its @files expanded, or argv itself if it has none.
+char **expand_args(struct interceptor_exec *exec, char *argv[], int *argc) {
+    struct arg_list list = {NULL, 0, 0};
+    int i = 1;
+    while (i < *argc && argv[i][0] != '@') {
+        i++;
+    }
+    if (i == *argc) {
+        return argv;
+    }
+    for (i = 0; i < *argc; i++) {
+        if (i == 0 || argv[i][0] != '@' || expand_response_file(exec, &list, argv[i] + 1, 1) != 0) {
+            arg_list_push(exec, &list, argv[i]);
+        }
+    }
+    arg_list_push(exec, &list, NULL);
+    *argc = list.argc - 1;
+    return list.argv;
+}
+
+// Appends c to the response file buffer, writing it out to fd when full.
+// Returns 0, or -1 if the write fails.
+int rsp_put(int fd, char *buf, size_t size, size_t *len, char c) {
+    if (*len == size) {
+        if (write(fd, buf, *len) != (ssize_t)*len) {
+            return -1;
+        }
+        *len = 0;
+    }
+    buf[(*len)++] = c;
+    return 0;
+}
+
+// Writes argv[1..] to an unlinked memfd response file that the compiler
+// inherits. Returns the fd, or -1. Uses no stdio, which allocates.
+int write_response_file(char *argv[]) {
+    char buf[4096];
+    size_t len = 0;
+    int failed = 0;
+    int fd = memfd_create("interceptor-rsp", 0);
+    if (fd < 0) {
+        return -1;
+    }
+    for (int i = 1; argv[i] && !failed; i++) {
+        if (!argv[i][0]) {
+            failed |= rsp_put(fd, buf, sizeof(buf), &len, '\'');
+            failed |= rsp_put(fd, buf, sizeof(buf), &len, '\'');
+        }
+        for (const char *p = argv[i]; *p; p++) {
+            if (*p == ' ' || (*p >= '\t' && *p <= '\r') || *p == '\'' || *p == '"' || *p == '\\') {
+                failed |= rsp_put(fd, buf, sizeof(buf), &len, '\\');
+            }
+            failed |= rsp_put(fd, buf, sizeof(buf), &len, *p);
+        }
+        failed |= rsp_put(fd, buf, sizeof(buf), &len, '\n');
+    }
+    if (failed || write(fd, buf, len) != (ssize_t)len) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+long long link_input_size(char *argv[], int argc) {
+    long long size = 0;
+    struct stat st;
+    for (int i = 1; i < argc && argv[i]; i++) {
+        if (classify_arg(argv[i]) == ARG_OUTPUT) {
+            i++;
+        } else if (argv[i][0] != '-' && stat(argv[i], &st) == 0 && S_ISREG(st.st_mode)) {
+            size += st.st_size;
+        }
+    }
+    return size;
+}
+
+// Returns the value of the last occurrence of option in MAKEFLAGS, or NULL.
+const char *makeflags_option(const char *makeflags, const char *option) {
+    const char *res = NULL;
+    for (const char *p = makeflags; (p = strstr(p, option)); p++) {
+        if (p == makeflags || p[-1] == ' ') {
+            res = p + strlen(option);
+        }
+    }
+    return res;
+}
+
+// Nonzero if make's jobserver is reachable from this process. make only
+// hands the pipe fds to recipes it treats as recursive, so they have to be
+// checked; the fifo of make 4.4 is open to every child.
+int jobserver_available(const char *makeflags) {
+    const char *auth = makeflags_option(makeflags, "--jobserver-auth=");
+    int rfd, wfd;
+    if (!auth) {
+        auth = makeflags_option(makeflags, "--jobserver-fds=");
+    }
+    if (!auth) {
+        return 0;
+    }
+    if (strings_equal_n(auth, "fifo:")) {
+        char path[4096];
+        int len = strcspn(auth + 5, " ");
+        snprintf(path, sizeof(path), "%.*s", len, auth + 5);
+        return access(path, R_OK | W_OK) == 0;
+    }
+    if (sscanf(auth, "%d,%d", &rfd, &wfd) != 2 || rfd < 0 || wfd < 0) {
+        return 0;
+    }
+    return fcntl(rfd, F_GETFD) >= 0 && fcntl(wfd, F_GETFD) >= 0;
+}
+
+// LTRANS jobs when there is no jobserver: make's -j if given, capped to the
+// CPUs that the load average leaves idle.
+int lto_jobs(const char *makeflags) {
+    cpu_set_t set;
+    double load;
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = CPU_COUNT(&set);
+    }
+    int jobs = cpus;
+    const char *j = makeflags_option(makeflags, "-j");
+    if (j && atoi(j) > 0 && atoi(j) < jobs) {
+        jobs = atoi(j);
+    }
+    if (getloadavg(&load, 1) == 1 && cpus - (int)load < jobs) {
+        jobs = cpus - (int)load;
+    }
+    return jobs > 0 ? jobs : 1;
+}
+
+// Appends the LTO mode of a link: small links keep -flto-partition=none, big
+// ones join make's jobserver, or run lto_jobs() LTRANS jobs, with about one
+// partition per LTO_PARTITION_BYTES of input.
+int add_lto_link_flags(struct interceptor_exec *exec, char *new_argv[], int new_argc, char *argv[], int argc) {
+    long long size = link_input_size(argv, argc);
+    const char *makeflags = getenv("MAKEFLAGS");
+    if (!makeflags) {
+        makeflags = "";
+    }
+    int jobserver = size >= LTO_SMALL_LINK_BYTES && jobserver_available(makeflags);
+    int jobs = size >= LTO_SMALL_LINK_BYTES ? lto_jobs(makeflags) : 1;
+    if (!jobserver && jobs == 1) {
+        new_argv[new_argc++] = "-flto";
+        new_argv[new_argc++] = "-flto-partition=none";
+        return new_argc;
+    }
+    long long partitions = size / LTO_PARTITION_BYTES;
+    if (partitions < jobs * 2) {
+        partitions = jobs * 2;
+    }
+    if (partitions > LTO_MAX_PARTITIONS) {
+        partitions = LTO_MAX_PARTITIONS;
+    }
+    char *lto = exec_alloc(exec, 32);
+    char *param = exec_alloc(exec, 48);
+    if (jobserver) {
+        snprintf(lto, 32, "-flto=jobserver");
+    } else {
+        snprintf(lto, 32, "-flto=%d", jobs);
+    }
+    snprintf(param, 48, "--param=lto-partitions=%lld", partitions);
+    new_argv[new_argc++] = lto;
+    new_argv[new_argc++] = "-flto-partition=balanced";
+    new_argv[new_argc++] = param;
+    return new_argc;
+}
+
+int interceptor_probing;
+
+int interceptor_matches(const char *pathname) {
+    char tool[RULE_PATTERN_MAX];
+    return rules_match(pathname, tool, sizeof(tool)) != ROLE_NONE;
+}
+
+int interceptor_rewrite(char *pathname, char *argv[], struct interceptor_exec *exec) {
+    int argc = 0;
+    while (argv[argc]) {
+        argc++;
+    }
+
+    char *new_pathname = NULL;
+    int new_argc = 0;
+    char **new_argv = NULL;
+
+    exec->rsp_fd = -1;
+    exec->added = 0;
+    exec->original_pathname = pathname;
+    exec->original_argv = argv;
+    exec->allocations = NULL;
+    if (interceptor_probing) {
+        exec->compiler = 0;
+        exec->pathname = pathname;
+        exec->argv = argv;
+        return 0;
+    }
+
+    char tool[RULE_PATTERN_MAX];
+    enum tool_role role = rules_match(pathname, tool, sizeof(tool));
+    int gcc_compiler = 0;
+    if (role == ROLE_COMPILER) {
+        // A driver only a rule names, such as clang, is treated like gcc.
+        gcc_compiler = match_list(tool, gcc_compiler_list);
+        gcc_compiler = gcc_compiler ? gcc_compiler : 1;
+    }
+    // gcc-<tool> only exists next to a tool of that exact name.
+    int binutils = match_list(get_basename(get_basename(pathname, '/'), '-'), binutils_list);
+
+    if (role == ROLE_BINUTILS) {
+        int lto_plugin_available = 0;
+        for (int i = 0; i < argc && argv[i]; i++) {
+            if (!strings_equal(argv[i], "--plugin")) {
+                continue;
+            }
+            if (!argv[i + 1]) {
+                continue;
+            }
+            i++;
+            if (!file_exists(argv[i])) {
+                continue;
+            }
+            if (strings_equal_n(get_basename(argv[i], '/'), "liblto_plugin.so")) {
+                lto_plugin_available = 1;
+            }
+        }
+        if (!lto_plugin_available) {
+            new_argv = exec_alloc(exec, (argc + 3) * sizeof(char *));
+            for (int i = 0; i < argc && argv[i]; i++) {
+                new_argv[new_argc++] = argv[i];
+            }
+            const char *slash = strrchr(pathname, '/');
+            int dirname_len = slash ? slash - pathname : 0;
+            char *new_lto_plugin_path = NULL;
+            char *wrapper_pathname = NULL;
+            struct stat tool_st;
+            int tool_known = stat(pathname, &tool_st) == 0;
+            enum tool_resolution resolution = tool_known ? tool_index_lookup(pathname, &tool_st) : TOOL_UNKNOWN;
+            if (resolution == TOOL_UNKNOWN || resolution == TOOL_PLUGIN_DIR) {
+                new_lto_plugin_path = exec_alloc(exec, dirname_len + strlen("./liblto_plugin.so") + 1);
+                sprintf(new_lto_plugin_path, "%.*s/liblto_plugin.so", slash ? dirname_len : 1, slash ? pathname : ".");
+            }
+            if (binutils && (resolution == TOOL_UNKNOWN || resolution == TOOL_GCC_WRAPPER)) {
+                wrapper_pathname = insert_wrapper(exec, pathname, "gcc-", binutils);
+            }
+            if (resolution == TOOL_UNKNOWN) {
+                if (file_exists(new_lto_plugin_path)) {
+                    resolution = TOOL_PLUGIN_DIR;
+                } else if (wrapper_pathname && (file_exists(wrapper_pathname) & 1)) { // Check if gcc wrapper is available
+                    resolution = TOOL_GCC_WRAPPER;
+                } else {
+                    resolution = TOOL_PLUGIN_DEFAULT;
+                }
+                // Execs without a heap only read the index.
+                if (tool_known && !exec->arena) {
+                    tool_index_store(pathname, &tool_st, resolution);
+                }
+            }
+            if (resolution == TOOL_PLUGIN_DIR) {
+                new_argv[new_argc++] = "--plugin";
+                new_argv[new_argc++] = new_lto_plugin_path;
+            } else if (resolution == TOOL_GCC_WRAPPER && wrapper_pathname) {
+                new_pathname = wrapper_pathname;
+                // If gcc wrapper is available, also modify argv[0]
+                // new_argv[0] = insert_wrapper(exec, argv[0], "gcc-", binutils);
+            } else {
+                new_argv[new_argc++] = "--plugin";
+                new_argv[new_argc++] = LTO_PLUGIN_PATH;
+            }
+            new_argv[new_argc] = NULL;
+        }
+    } else if (gcc_compiler) {
+        // CMake and Ninja pass long command lines in @files.
+        int args_argc = argc;
+        char **args = expand_args(exec, argv, &args_argc);
+        int link = 1;
+        int compile = 0;
+        int fuse_ld = 0;
+        int lto_args = 0;
+        int debug = 0;
+        int debug_layout = 0;
+        int inputs = 0;
+        int sources = 0;
+        const char *source = NULL;
+        const char *output = NULL;
+        size_t bytes = 0;
+
+        // Configure probes run as they are, so check for them before
+        // resolving the CPU flags.
+        for (int i = 1; i < args_argc; i++) {
+            if (classify_arg(args[i]) == ARG_PROBE ||
+                strings_equal_n(get_basename(args[i], '/'), "conftest")) {
+                interceptor_exec_release(exec);
+                goto skip_interception;
+            }
+        }
+
+        char **native = NULL;
+        int native_count = native_flags(exec, pathname, &native);
+
+        new_argv = exec_alloc(exec, (args_argc + native_count + MAX_NEW_ARGV) * sizeof(char *));
+
+        new_argv[new_argc++] = args[0];
+        if (native_count) {
+            for (int i = 0; i < native_count; i++) {
+                new_argv[new_argc++] = native[i];
+            }
+        } else {
+            new_argv[new_argc++] = "-march=native";
+            new_argv[new_argc++] = "-mtune=native";
+        }
+
+        for (int i = 1; i < args_argc; i++) {
+            enum arg_class class = classify_arg(args[i]);
+            // Remove -O*, -march and -mtune
+            if (class == ARG_STRIP) {
+                continue;
+            }
+            if (class == ARG_NO_LINK) {
+                link = 0;
+                compile |= strings_equal(args[i], "-c");
+            } else if (class == ARG_OUTPUT && i + 1 < args_argc) {
+                new_argv[new_argc++] = args[i++];
+                bytes += strlen(args[i]) + 1;
+                output = args[i];
+            } else if (args[i][0] != '-') {
+                inputs++;
+                if (has_suffix(args[i], source_suffixes)) {
+                    source = args[i];
+                    sources++;
+                }
+            } else if (strings_equal_n(args[i], "-fuse-ld=")) {
+                fuse_ld = 1;
+            } else if (strings_equal_n(args[i], "-flto")) {
+                lto_args = 1;
+            } else if (args[i][1] == 'g') {
+                enum debug_option option = debug_option(args[i]);
+                if (option == DEBUG_ON || option == DEBUG_OFF) {
+                    debug = option == DEBUG_ON;
+                }
+                debug_layout |= option == DEBUG_LAYOUT;
+            }
+            bytes += strlen(args[i]) + 1;
+            new_argv[new_argc++] = args[i];
+        }
+
+        // Add new arguments
+        exec->added = new_argc;
+        struct profile profile;
+        int lto;
+        if (profile_lookup(tool, &profile) == 0) {
+            char **grown = exec_alloc(exec, (new_argc + profile.nr_flags + MAX_NEW_ARGV) * sizeof(char *));
+            memcpy(grown, new_argv, new_argc * sizeof(char *));
+            new_argv = grown;
+            for (int i = 0; i < profile.nr_flags; i++) {
+                new_argv[new_argc++] = (char *)profile_flag(&profile, i);
+            }
+            lto = profile.options & PROFILE_LTO;
+        } else {
+            for (int i = 0; default_profile_flags[i]; i++) {
+                new_argv[new_argc++] = default_profile_flags[i];
+            }
+            lto = file_exists("/usr/bin/interceptor_use_lto");
+        }
+        if (lto) {
+            if (link && inputs) {
+                new_argc = add_lto_link_flags(exec, new_argv, new_argc, args, args_argc);
+            } else {
+                new_argv[new_argc++] = "-flto";
+            }
+            new_argv[new_argc++] = "-fno-fat-lto-objects";
+            new_argv[new_argc++] = "-flto-compression-level=0";
+            new_argv[new_argc++] = "-fuse-linker-plugin";
+        }
+        enum pgo_phase phase = pgo_phase();
+        if (phase != PGO_OFF && compile && output) {
+            new_argc = add_pgo_flags(exec, phase, new_argv, new_argc, output);
+        } else if (phase != PGO_OFF && compile && sources == 1) {
+            // gcc puts the object in the working directory. Commands that
+            // compile several sources at once build them without PGO, as
+            // their objects would need a profile directory each.
+            char object[PATH_MAX];
+            replace_suffix(object, sizeof(object), get_basename(source, '/'), ".o");
+            new_argc = add_pgo_flags(exec, phase, new_argv, new_argc, object);
+        } else if (phase != PGO_OFF && link && sources) {
+            // Compiled and linked in one step: the profiles of all its
+            // sources go to the directory of the program.
+            new_argc = add_pgo_flags(exec, phase, new_argv, new_argc, output ? output : "a.out");
+        } else if (phase != PGO_OFF && link && inputs) {
+            new_argc = add_pgo_flags(exec, phase, new_argv, new_argc, NULL);
+        }
+        int split_dwarf = debug && !debug_layout && debuginfo_enabled();
+        int linker = -1;
+        int linker_features = 0;
+        // xgcc and xg++ keep their default linker.
+        if (gcc_compiler < 5 && !fuse_ld && ((link && inputs) || split_dwarf)) {
+            linker = linker_choose(pathname, lto || lto_args, &linker_features, exec->arena != NULL);
+        }
+        if (linker >= 0 && link && inputs) {
+            const char *makeflags = getenv("MAKEFLAGS");
+            new_argc = add_linker_flags(exec, linker, new_argv, new_argc, lto_jobs(makeflags ? makeflags : ""));
+        }
+        if (split_dwarf) {
+            new_argc = add_debuginfo_flags(new_argv, new_argc, lto || lto_args, link && inputs, linker_features);
+        }
+
+        new_argv[new_argc] = NULL;
+
+        // Hand an expanded command line that is too long back as a file.
+        if (args != argv && bytes > RSP_INLINE_BYTES) {
+            exec->rsp_fd = write_response_file(new_argv);
+            if (exec->rsp_fd >= 0) {
+                char *rsp = exec_alloc(exec, 32);
+                snprintf(rsp, 32, "@/proc/self/fd/%d", exec->rsp_fd);
+                new_argv[1] = rsp;
+                new_argv[2] = NULL;
+                new_argc = 2;
+            }
+        }
+    }
+
+skip_interception:
+    exec->compiler = gcc_compiler && new_argc;
+    exec->pathname = new_pathname ? new_pathname : pathname;
+    exec->argv = new_argc ? new_argv : argv;
+    return new_pathname || new_argc;
+}
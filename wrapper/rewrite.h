@@ -0,0 +1,79 @@
+#ifndef INTERCEPTOR_REWRITE_H
+#define INTERCEPTOR_REWRITE_H
+
+#include <setjmp.h>
+#include <stddef.h>
+
+struct exec_allocation;
+
+// Memory for the rewrite of an exec that must not touch the heap, such as one
+// in a vfork child. exec_alloc() takes from data and jumps to full when it
+// runs out. Resolutions that would need a probe are skipped.
+struct exec_arena {
+    char *data;
+    size_t size;
+    size_t used;
+    jmp_buf full;
+};
+
+struct interceptor_exec {
+    char *pathname;
+    char **argv;
+    int compiler; // nonzero if argv is a rewritten compiler command line
+    int rsp_fd;   // response file passed to the compiler, or -1
+    int added;    // index of the first flag the wrapper appended to argv
+    char *original_pathname;
+    char **original_argv;
+    struct exec_allocation *allocations;
+    struct exec_arena *arena; // set by the caller; NULL to use the heap
+};
+
+// Built-in tool names, used where no rule table is loaded and to give rules
+// without a role one. Compiler drivers and binutils are matched after the last
+// '-', binutils_new_list on the whole basename.
+extern char *const gcc_compiler_list[];
+extern char *const binutils_list[];
+extern char *const binutils_new_list[];
+
+// Suffixes of the source files the compiler drivers compile.
+extern char *const source_suffixes[];
+
+int strings_equal(const char *str1, const char *str2);
+int strings_equal_n(const char *str1, const char *str2);
+int match_list(const char *str, char *const list[]);
+int has_suffix(const char *str, char *const list[]);
+// Replaces the suffix of path with suffix, the way gcc names default outputs.
+void replace_suffix(char *buf, size_t size, const char *path, const char *suffix);
+char *get_basename(const char *path, const char delimiter);
+int file_exists(const char *path);
+
+// Set while the wrapper runs a helper command of its own, such as a linker
+// probe. Forked children inherit it, so the preload library leaves their
+// execs alone.
+extern int interceptor_probing;
+
+// Cheap name-only check against the rules: returns nonzero if
+// interceptor_rewrite() may change an exec of pathname.
+int interceptor_matches(const char *pathname);
+
+// Applies the compiler and binutils rewrite rules to an exec of pathname with
+// argv. exec receives the program and arguments to run instead; returns
+// nonzero if anything was changed.
+int interceptor_rewrite(char *pathname, char *argv[], struct interceptor_exec *exec);
+
+// Returns argv with its @files expanded, or argv itself if it has none.
+// argc is updated.
+char **expand_args(struct interceptor_exec *exec, char *argv[], int *argc);
+
+// Total size of the regular files among the inputs of a link command.
+long long link_input_size(char *argv[], int argc);
+
+// Frees what interceptor_rewrite() allocated for exec. Only needed when the
+// process outlives the exec, as in the preload library.
+void interceptor_exec_release(struct interceptor_exec *exec);
+
+// Allocates memory that lives until interceptor_exec_release(), or from
+// exec->arena if there is one.
+void *exec_alloc(struct interceptor_exec *exec, size_t size);
+
+#endif
@@ -0,0 +1,247 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rewrite.h"
+#include "rules.h"
+#include "toolindex.h"
+
+// The grammar and the matching are the module's: one rule per line,
+// <wrap|rewrite|pass> <exact|suffix|prefix|tool> <pattern> [role] [wrapper].
+// A pass rule wins, otherwise the most specific rule does. A rule without a
+// role takes the one the built-in lists give its tool name, so rules for
+// gcc-12 or x86_64-linux-gnu-gcc-12 need none, but one for clang does.
+//
+// The table lives in static memory, hashed on kind and pattern into open
+// addressing, so matching in a vfork child doesn't touch the heap. A lookup
+// probes once per kind, and once per distinct pattern length for prefix and
+// suffix rules.
+
+#define RULES_MAX 256
+#define RULES_BUCKETS 512
+// The module prints at most a page; a file may be longer.
+#define RULES_SOURCE_MAX (16 * 1024)
+
+enum rule_kind {
+    RULE_EXACT,
+    RULE_SUFFIX,
+    RULE_PREFIX,
+    RULE_TOOL,
+    RULE_KINDS,
+};
+
+struct rule {
+    unsigned char kind;
+    unsigned char pass;
+    unsigned char role; // ROLE_NONE to take it from the tool name
+    unsigned char len;
+    char pattern[RULE_PATTERN_MAX];
+};
+
+char *const rule_kind_names[] = {"exact", "suffix", "prefix", "tool", NULL};
+// In enum tool_role order, from ROLE_COMPILER.
+char *const rule_role_names[] = {"compiler", "binutils", NULL};
+
+struct rule rules_table[RULES_MAX];
+// Index + 1 of the rule in each bucket, 0 if it is free.
+short rules_buckets[RULES_BUCKETS];
+uint64_t rules_len_mask[RULE_KINDS];
+int rules_count;
+// 0 until rules_load(), 1 with a table, -1 with the built-in lists.
+int rules_state;
+
+unsigned int rules_bucket(int kind, const char *str, size_t len) {
+    return (fnv1a(str, len) + kind) % RULES_BUCKETS;
+}
+
+struct rule *rules_find(int kind, const char *str, size_t len) {
+    if (len == 0 || len >= RULE_PATTERN_MAX) {
+        return NULL;
+    }
+    for (unsigned int i = rules_bucket(kind, str, len); rules_buckets[i]; i = (i + 1) % RULES_BUCKETS) {
+        struct rule *rule = &rules_table[rules_buckets[i] - 1];
+        if (rule->kind == kind && rule->len == len && memcmp(rule->pattern, str, len) == 0) {
+            return rule;
+        }
+    }
+    return NULL;
+}
+
+char *rules_token(char **line) {
+    *line += strspn(*line, " \t\r");
+    if (!**line) {
+        return NULL;
+    }
+    char *token = *line;
+    *line += strcspn(*line, " \t\r");
+    if (**line) {
+        *(*line)++ = '\0';
+    }
+    return token;
+}
+
+// Returns 0, or -1 if the line is invalid, as the module would.
+int rules_parse_line(char *line) {
+    char *action = rules_token(&line);
+    char *kind = rules_token(&line);
+    char *pattern = rules_token(&line);
+    char *token = rules_token(&line);
+
+    if (!action || action[0] == '#') {
+        return 0;
+    }
+    int role = token ? match_list(token, rule_role_names) : 0;
+    // The wrapper path that may follow is the module's business.
+    if (role) {
+        token = rules_token(&line);
+    }
+    if (!kind || !pattern || (token && rules_token(&line)) || rules_count == RULES_MAX) {
+        return -1;
+    }
+    struct rule *rule = &rules_table[rules_count];
+    if (strings_equal(action, "pass")) {
+        rule->pass = 1;
+    } else if (!strings_equal(action, "wrap") && !strings_equal(action, "rewrite")) {
+        return -1;
+    }
+    int kind_index = match_list(kind, rule_kind_names);
+    size_t len = strlen(pattern);
+    if (!kind_index || len >= RULE_PATTERN_MAX || rules_find(kind_index - 1, pattern, len)) {
+        return -1;
+    }
+    rule->kind = kind_index - 1;
+    rule->role = role ? ROLE_COMPILER + role - 1 : ROLE_NONE;
+    rule->len = len;
+    memcpy(rule->pattern, pattern, len + 1);
+
+    unsigned int i = rules_bucket(rule->kind, pattern, len);
+    while (rules_buckets[i]) {
+        i = (i + 1) % RULES_BUCKETS;
+    }
+    rules_buckets[i] = ++rules_count;
+    rules_len_mask[rule->kind] |= 1ULL << len;
+    return 0;
+}
+
+void rules_load(void) {
+    char source[RULES_SOURCE_MAX];
+
+    if (rules_state) {
+        return;
+    }
+    rules_state = -1;
+    const char *path = getenv("INTERCEPTOR_RULES");
+    int fd = open(path && *path ? path : RULES_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    size_t len = 0;
+    ssize_t n = 0;
+    while (len < sizeof(source) && (n = read(fd, source + len, sizeof(source) - len)) > 0) {
+        len += n;
+    }
+    close(fd);
+    if (n < 0 || len == sizeof(source)) {
+        return;
+    }
+    source[len] = '\0';
+
+    char *cursor = source;
+    while (cursor) {
+        char *line = cursor;
+        cursor = strchr(cursor, '\n');
+        if (cursor) {
+            *cursor++ = '\0';
+        }
+        // The module refuses such a table, so nothing it loaded looks like it.
+        if (rules_parse_line(line) != 0) {
+            memset(rules_buckets, 0, sizeof(rules_buckets));
+            memset(rules_len_mask, 0, sizeof(rules_len_mask));
+            rules_count = 0;
+            return;
+        }
+    }
+    rules_state = 1;
+}
+
+// Records a candidate; returns 1 if a pass rule ends the search.
+int rules_pick(struct rule **match, struct rule *rule) {
+    if (!rule) {
+        return 0;
+    }
+    if (rule->pass) {
+        return 1;
+    }
+    if (!*match) {
+        *match = rule;
+    }
+    return 0;
+}
+
+// The rule for name, or NULL if none or a pass rule matches.
+struct rule *rules_lookup(const char *name) {
+    size_t name_len = strlen(name);
+    size_t max_len = name_len < RULE_PATTERN_MAX - 1 ? name_len : RULE_PATTERN_MAX - 1;
+    uint64_t len_range = ((2ULL << max_len) - 1) & ~1ULL;
+    struct rule *match = NULL;
+
+    if (rules_pick(&match, rules_find(RULE_EXACT, name, name_len))) {
+        return NULL;
+    }
+    for (uint64_t lens = rules_len_mask[RULE_SUFFIX] & len_range; lens; lens &= lens - 1) {
+        size_t len = __builtin_ctzll(lens);
+        if (rules_pick(&match, rules_find(RULE_SUFFIX, name + name_len - len, len))) {
+            return NULL;
+        }
+    }
+    for (uint64_t lens = rules_len_mask[RULE_PREFIX] & len_range; lens; lens &= lens - 1) {
+        if (rules_pick(&match, rules_find(RULE_PREFIX, name, __builtin_ctzll(lens)))) {
+            return NULL;
+        }
+    }
+    const char *tool = get_basename(name, '-');
+    if (rules_pick(&match, rules_find(RULE_TOOL, tool, strlen(tool)))) {
+        return NULL;
+    }
+    return match;
+}
+
+// The role the built-in lists give a tool.
+enum tool_role rules_builtin_role(const char *name, const char *tool) {
+    if (match_list(tool, gcc_compiler_list)) {
+        return ROLE_COMPILER;
+    }
+    if (match_list(tool, binutils_list) || match_list(name, binutils_new_list)) {
+        return ROLE_BINUTILS;
+    }
+    return ROLE_NONE;
+}
+
+enum tool_role rules_match(const char *pathname, char *tool, size_t size) {
+    const char *name = get_basename(pathname, '/');
+    const char *end = name + strlen(name);
+    const char *dash = strrchr(name, '-');
+    if (dash && dash > name && dash[1] && !dash[1 + strspn(dash + 1, "0123456789.")]) {
+        end = dash;
+    }
+    const char *start = end;
+    while (start > name && start[-1] != '-') {
+        start--;
+    }
+    size_t len = end - start < (long)size ? (size_t)(end - start) : size - 1;
+    memcpy(tool, start, len);
+    tool[len] = '\0';
+
+    rules_load();
+    if (rules_state < 0) {
+        // Like the module's default table, which doesn't match gcc-12.
+        return rules_builtin_role(name, get_basename(name, '-'));
+    }
+    struct rule *rule = rules_lookup(name);
+    if (!rule) {
+        return ROLE_NONE;
+    }
+    return rule->role ? rule->role : rules_builtin_role(name, tool);
+}
@@ -0,0 +1,31 @@
+#ifndef INTERCEPTOR_RULES_H
+#define INTERCEPTOR_RULES_H
+
+#include <stddef.h>
+
+// The match rule table of interceptor-km, so that the wrapper and the preload
+// library act on the same execs the module sends them. It is read from the
+// file named by INTERCEPTOR_RULES, else from the module parameter. Without
+// either, the built-in compiler and binutils lists decide.
+
+#define RULES_PATH "/sys/module/interceptor_km/parameters/rules"
+// Same limit as the module.
+#define RULE_PATTERN_MAX 64
+
+// What the wrapper does with a matching exec.
+enum tool_role {
+    ROLE_NONE, // run unchanged
+    ROLE_COMPILER,
+    ROLE_BINUTILS,
+};
+
+// Reads the table if it hasn't been read yet. The preload library calls it
+// when it loads, since a vfork child can't.
+void rules_load(void);
+
+// Returns the role the rules give an exec of pathname, or ROLE_NONE if a pass
+// rule or no rule matches. tool receives the name the role and profiles go
+// by: the part after the last '-', skipping a version suffix such as "-12".
+enum tool_role rules_match(const char *pathname, char *tool, size_t size);
+
+#endif
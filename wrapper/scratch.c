@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "scratch.h"
+#include "util.h"
+
+// Each job gets its own directory, <pid>-<start time>-<reserved bytes>, in
+// $INTERCEPTOR_SCRATCH_DIR (default /dev/shm/interceptor-<uid>), and runs
+// with TMPDIR pointing at it. A job takes one only while the scratch area
+// stays within INTERCEPTOR_SCRATCH_SIZE (default half of its filesystem).
+// Directories are charged the larger of their reservation and what they
+// hold. Otherwise the job spills to the usual TMPDIR.
+//
+// The wrapper execs the compiler in place, so a directory lives as long as
+// its pid. Jobs look for room under a lock on <dir>/.lock, and remove the
+// directories of dead processes as they go, including what compilers that
+// crashed or were killed left behind.
+
+#define SCRATCH_JOB_BYTES (16LL << 20)
+#define SCRATCH_SOURCE_FACTOR 4
+#define SCRATCH_LTO_FACTOR 2
+
+enum scratch_stat {
+    SCRATCH_USED,
+    SCRATCH_SPILLED,
+    SCRATCH_STAT_COUNT,
+};
+
+const char *const scratch_stat_names[SCRATCH_STAT_COUNT] = {"scratch", "spilled"};
+
+long long scratch_usage_bytes;
+
+int scratch_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_SCRATCH");
+    return value && *value && !strings_equal(value, "0");
+}
+
+int scratch_dir(char *path, size_t size) {
+    const char *dir = getenv("INTERCEPTOR_SCRATCH_DIR");
+    int len;
+    if (dir && *dir) {
+        len = snprintf(path, size, "%s", dir);
+    } else {
+        len = snprintf(path, size, "/dev/shm/interceptor-%d", (int)getuid());
+    }
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+// Scratch space the temporaries of the command in exec may take: LTRANS
+// partitions and their objects for LTO links, the assembly of compiles
+// without -pipe.
+long long scratch_estimate(struct interceptor_exec *exec) {
+    int argc = 0;
+    int compile = 0;
+    int lto = 0;
+    int pipe = 0;
+    struct stat st;
+
+    while (exec->argv[argc]) {
+        argc++;
+    }
+    char **argv = exec->rsp_fd >= 0 ? expand_args(exec, exec->argv, &argc) : exec->argv;
+    for (int i = 1; i < argc; i++) {
+        if (strings_equal(argv[i], "-c") || strings_equal(argv[i], "-S")) {
+            compile = 1;
+        } else if (strings_equal(argv[i], "-pipe")) {
+            pipe = 1;
+        } else if (strings_equal(argv[i], "-flto") || strings_equal_n(argv[i], "-flto=")) {
+            lto = 1;
+        } else if (strings_equal(argv[i], "-fno-lto")) {
+            lto = 0;
+        }
+    }
+    if (compile) {
+        const char *source = command_source(argv);
+        long long size = !pipe && source && stat(source, &st) == 0 ? st.st_size : 0;
+        return SCRATCH_JOB_BYTES + size * SCRATCH_SOURCE_FACTOR;
+    }
+    return SCRATCH_JOB_BYTES + (lto ? link_input_size(argv, argc) * SCRATCH_LTO_FACTOR : 0);
+}
+
+int add_usage(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)path;
+    (void)type;
+    (void)ftw;
+    scratch_usage_bytes += (long long)st->st_blocks * 512;
+    return 0;
+}
+
+int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+// Sums what the live job directories in dir are charged, and removes the
+// dead ones. Returns -1 if dir can't be read.
+long long scratch_sweep(const char *dir, int print) {
+    char path[PATH_MAX];
+    struct dirent *ent;
+    long long charged = 0;
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    while ((ent = readdir(d))) {
+        int pid;
+        unsigned long long start;
+        long long reserved;
+        char state;
+        unsigned long long starttime;
+        if (sscanf(ent->d_name, "%d-%llu-%lld", &pid, &start, &reserved) != 3) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if (process_start(pid, &state, &starttime) != 0 || state == 'Z' || starttime != start) {
+            nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+            continue;
+        }
+        scratch_usage_bytes = 0;
+        nftw(path, add_usage, 16, FTW_PHYS);
+        charged += scratch_usage_bytes > reserved ? scratch_usage_bytes : reserved;
+        if (print) {
+            printf("pid %d reserved_mb %lld used_mb %lld\n", pid, reserved >> 20, scratch_usage_bytes >> 20);
+        }
+    }
+    closedir(d);
+    return charged;
+}
+
+long long scratch_budget(const char *dir, long long *available) {
+    struct statvfs vfs;
+    if (statvfs(dir, &vfs) != 0) {
+        return -1;
+    }
+    *available = (long long)vfs.f_bavail * vfs.f_frsize;
+    return parse_size(getenv("INTERCEPTOR_SCRATCH_SIZE"), (long long)vfs.f_blocks * vfs.f_frsize / 2);
+}
+
+void scratch_count(enum scratch_stat stat) {
+    char path[PATH_MAX];
+    long long deltas[SCRATCH_STAT_COUNT] = {0};
+    deltas[stat] = 1;
+    if (state_path(path, sizeof(path), "scratch.stats") == 0) {
+        counters_update(path, scratch_stat_names, deltas, NULL, SCRATCH_STAT_COUNT);
+    }
+}
+
+char **scratch_enter(struct interceptor_exec *exec, char *envp[]) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    char state;
+    unsigned long long starttime;
+    long long available;
+
+    long long need = scratch_estimate(exec);
+    if (scratch_dir(dir, sizeof(dir)) != 0 || process_start(getpid(), &state, &starttime) != 0) {
+        return envp;
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return envp;
+    }
+    if (snprintf(path, sizeof(path), "%s/.lock", dir) >= (int)sizeof(path)) {
+        return envp;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return envp;
+    }
+    flock(fd, LOCK_EX);
+    long long budget = scratch_budget(dir, &available);
+    long long charged = scratch_sweep(dir, 0);
+    int fits = budget >= 0 && charged >= 0 && charged + need <= budget && need <= available;
+    fits = fits && snprintf(path, sizeof(path), "TMPDIR=%s/%d-%llu-%lld", dir, (int)getpid(), starttime, need) <
+                       (int)sizeof(path);
+    if (fits && mkdir(path + 7, 0700) != 0 && errno != EEXIST) {
+        fits = 0;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    scratch_count(fits ? SCRATCH_USED : SCRATCH_SPILLED);
+    if (!fits) {
+        return envp;
+    }
+
+    int count = 0;
+    while (envp[count]) {
+        count++;
+    }
+    char **new_envp = malloc((count + 2) * sizeof(char *));
+    char *tmpdir = strdup(path);
+    if (!new_envp || !tmpdir) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    int new_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (!strings_equal_n(envp[i], "TMPDIR=")) {
+            new_envp[new_count++] = envp[i];
+        }
+    }
+    new_envp[new_count++] = tmpdir;
+    new_envp[new_count] = NULL;
+    return new_envp;
+}
+
+int scratch_print_status(void) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    long long values[SCRATCH_STAT_COUNT];
+    long long available;
+
+    if (scratch_dir(dir, sizeof(dir)) != 0) {
+        fprintf(stderr, "interceptor: invalid scratch directory\n");
+        return 1;
+    }
+    printf("dir %s\n", dir);
+    int fits = snprintf(path, sizeof(path), "%s/.lock", dir) < (int)sizeof(path);
+    int fd = fits ? open(path, O_RDWR | O_CLOEXEC) : -1;
+    if (fd >= 0) {
+        flock(fd, LOCK_EX);
+        long long charged = scratch_sweep(dir, 1);
+        flock(fd, LOCK_UN);
+        close(fd);
+        printf("charged_mb %lld\n", charged >> 20);
+        printf("budget_mb %lld\n", scratch_budget(dir, &available) >> 20);
+    }
+    if (state_file(path, sizeof(path), "scratch.stats") == 0 &&
+        counters_read(path, scratch_stat_names, values, SCRATCH_STAT_COUNT) == 0) {
+        for (int i = 0; i < SCRATCH_STAT_COUNT; i++) {
+            printf("%s %lld\n", scratch_stat_names[i], values[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef INTERCEPTOR_SCRATCH_H
+#define INTERCEPTOR_SCRATCH_H
+
+#include "rewrite.h"
+
+// Scratch space: compiler and LTO temporaries go to a tmpfs directory while
+// it has room.
+
+// Nonzero if INTERCEPTOR_SCRATCH asks for scratch space.
+int scratch_enabled(void);
+
+// Reserves scratch space for the rewritten command in exec. Returns envp
+// with TMPDIR pointing into the scratch area, or envp itself if the job
+// spills to TMPDIR.
+char **scratch_enter(struct interceptor_exec *exec, char *envp[]);
+
+// Prints the scratch directories and counters for
+// `interceptor scratch-status`.
+int scratch_print_status(void);
+
+#endif
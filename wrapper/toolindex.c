@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "toolindex.h"
+#include "util.h"
+
+// A fixed-size hash table in $INTERCEPTOR_STATE_DIR/tools.idx of
+// TOOL_INDEX_BUCKETS buckets of TOOL_INDEX_WAYS slots, one bucket per key
+// hash. A process maps the file read-only and shared once, so lookups are
+// plain memory reads that see the stores of other processes. Writers pwrite
+// a whole slot under an flock on the file, so two of them don't pick the
+// same free slot; a checksum over the slot rejects torn slots, which just
+// count as misses. Entries stay valid until the inode or mtime they were
+// derived from changes.
+
+#define TOOL_INDEX_BUCKETS 64
+#define TOOL_INDEX_WAYS 4
+
+struct tool_index_entry {
+    uint64_t checksum; // of the rest of the slot; 0 for an empty slot
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t created;
+    uint32_t value;
+    uint32_t path_len;
+    char path[200];
+};
+
+_Static_assert(sizeof(struct tool_index_entry) == 256, "tool index slots are 256 bytes");
+
+#define TOOL_INDEX_SIZE (TOOL_INDEX_BUCKETS * TOOL_INDEX_WAYS * sizeof(struct tool_index_entry))
+
+// tools.idx, once a lookup has found it at full size.
+const struct tool_index_entry *tool_index_map;
+
+uint64_t fnv1a(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t entry_checksum(const struct tool_index_entry *entry) {
+    return fnv1a((const char *)entry + sizeof(entry->checksum), sizeof(*entry) - sizeof(entry->checksum)) | 1;
+}
+
+off_t bucket_offset(const char *key) {
+    return (off_t)(fnv1a(key, strlen(key)) % TOOL_INDEX_BUCKETS) * TOOL_INDEX_WAYS * sizeof(struct tool_index_entry);
+}
+
+int entry_valid(const struct tool_index_entry *entry) {
+    return entry->checksum && entry->checksum == entry_checksum(entry);
+}
+
+int entry_matches(const struct tool_index_entry *entry, const char *key, size_t len) {
+    return entry_valid(entry) && entry->path_len == len && memcmp(entry->path, key, len) == 0;
+}
+
+// Maps tools.idx if it isn't mapped yet. Returns NULL if it doesn't exist, or
+// is shorter than the table, as files of older wrappers may be.
+const struct tool_index_entry *tool_index_open(void) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (tool_index_map || state_file(path, sizeof(path), "tools.idx") != 0) {
+        return tool_index_map;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)TOOL_INDEX_SIZE) {
+        map = mmap(NULL, TOOL_INDEX_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map != MAP_FAILED) {
+        tool_index_map = map;
+    }
+    return tool_index_map;
+}
+
+uint32_t tool_index_lookup(const char *key, const struct stat *st) {
+    const struct tool_index_entry *map = tool_index_open();
+    struct tool_index_entry entry;
+    size_t len = strlen(key);
+
+    if (!map || len >= sizeof(entry.path)) {
+        return 0;
+    }
+    const struct tool_index_entry *bucket = map + bucket_offset(key) / sizeof(entry);
+    for (int i = 0; i < TOOL_INDEX_WAYS; i++) {
+        // A copy, so a concurrent store can't change it after the checksum.
+        memcpy(&entry, &bucket[i], sizeof(entry));
+        if (entry_matches(&entry, key, len) && entry.dev == st->st_dev && entry.ino == st->st_ino &&
+            entry.mtime_sec == st->st_mtim.tv_sec && entry.mtime_nsec == st->st_mtim.tv_nsec) {
+            return entry.value;
+        }
+    }
+    return 0;
+}
+
+void tool_index_store(const char *key, const struct stat *st, uint32_t value) {
+    struct tool_index_entry bucket[TOOL_INDEX_WAYS];
+    struct tool_index_entry entry;
+    char path[PATH_MAX];
+    size_t len = strlen(key);
+
+    if (len >= sizeof(entry.path) || state_path(path, sizeof(path), "tools.idx") != 0) {
+        return;
+    }
+    memset(&entry, 0, sizeof(entry));
+    entry.dev = st->st_dev;
+    entry.ino = st->st_ino;
+    entry.mtime_sec = st->st_mtim.tv_sec;
+    entry.mtime_nsec = st->st_mtim.tv_nsec;
+    entry.created = time(NULL);
+    entry.value = value;
+    entry.path_len = len;
+    memcpy(entry.path, key, len);
+    entry.checksum = entry_checksum(&entry);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    // Mappings need the whole table; the missing slots read as free.
+    struct stat file_st;
+    if (fstat(fd, &file_st) == 0 && file_st.st_size < (off_t)TOOL_INDEX_SIZE && ftruncate(fd, TOOL_INDEX_SIZE) != 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return;
+    }
+    off_t offset = bucket_offset(key);
+    memset(bucket, 0, sizeof(bucket));
+    ssize_t n = pread(fd, bucket, sizeof(bucket), offset);
+    // The key's own slot, else a free or torn one, else the oldest.
+    int way = -1;
+    for (int i = 0; i < TOOL_INDEX_WAYS && way < 0; i++) {
+        if (entry_matches(&bucket[i], key, len)) {
+            way = i;
+        }
+    }
+    for (int i = 0; i < TOOL_INDEX_WAYS && way < 0; i++) {
+        if (!entry_valid(&bucket[i])) {
+            way = i;
+        }
+    }
+    if (way < 0) {
+        way = 0;
+        for (int i = 1; i < TOOL_INDEX_WAYS; i++) {
+            if (bucket[i].created < bucket[way].created) {
+                way = i;
+            }
+        }
+    }
+    // A short write leaves a slot that fails its checksum, i.e. a miss.
+    n = pwrite(fd, &entry, sizeof(entry), offset + way * sizeof(entry));
+    (void)n;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
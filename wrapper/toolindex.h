@@ -0,0 +1,27 @@
+#ifndef INTERCEPTOR_TOOLINDEX_H
+#define INTERCEPTOR_TOOLINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// How ar, nm and ranlib get the LTO plugin when argv doesn't pass one.
+enum tool_resolution {
+    TOOL_UNKNOWN,
+    TOOL_PLUGIN_DIR,     // <dirname of the tool>/liblto_plugin.so
+    TOOL_GCC_WRAPPER,    // exec gcc-<tool> instead
+    TOOL_PLUGIN_DEFAULT, // LTO_PLUGIN_PATH
+};
+
+// 64-bit FNV-1a hash of data.
+uint64_t fnv1a(const void *data, size_t len);
+
+// Returns the cached value for key, such as the tool_resolution of the tool
+// at that path, or 0 (TOOL_UNKNOWN). st is the stat of the file the value
+// was derived from; entries go stale when its inode or mtime changes.
+uint32_t tool_index_lookup(const char *key, const struct stat *st);
+
+// Records a nonzero value for key, derived from the file with stat st.
+void tool_index_store(const char *key, const struct stat *st, uint32_t value);
+
+#endif
@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "util.h"
+
+// Records are lines in $INTERCEPTOR_TRACE_DIR/<shard>.log (default
+// $INTERCEPTOR_STATE_DIR/trace), one shard per pid modulo TRACE_SHARDS:
+//
+//   <start ns> <duration ns> <status>\t<cwd>\t<output>\t<argv[0]>\t<argv[1]>...
+//
+// Fields escape '\\', '\t' and '\n'. Each record is a single O_APPEND write,
+// which the kernel never interleaves with other writes to the file, so
+// parallel compiles need no locks.
+
+#define TRACE_SHARDS 16
+
+int trace_enabled(void) {
+    const char *value = getenv("INTERCEPTOR_TRACE");
+    return value && *value && !strings_equal(value, "0");
+}
+
+int trace_dir(char *path, size_t size) {
+    const char *dir = getenv("INTERCEPTOR_TRACE_DIR");
+    if (!dir || !*dir) {
+        return state_file(path, size, "trace");
+    }
+    int len = snprintf(path, size, "%s", dir);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+long long trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct trace_buf {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+// The buffer is allocated for exec, so that the preload library can trace
+// from a vfork child.
+void trace_append(struct interceptor_exec *exec, struct trace_buf *buf, const char *str, int escape) {
+    size_t len = strlen(str);
+    if (buf->len + len * 2 + 2 > buf->capacity) {
+        buf->capacity = (buf->len + len * 2 + 2) * 2;
+        char *data = exec_alloc(exec, buf->capacity);
+        if (buf->len) {
+            memcpy(data, buf->data, buf->len);
+        }
+        buf->data = data;
+    }
+    for (; *str; str++) {
+        if (escape && (*str == '\\' || *str == '\t' || *str == '\n')) {
+            buf->data[buf->len++] = '\\';
+            buf->data[buf->len++] = *str == '\t' ? 't' : *str == '\n' ? 'n' : '\\';
+        } else {
+            buf->data[buf->len++] = *str;
+        }
+    }
+}
+
+void trace_record(struct interceptor_exec *exec, long long start, long long end, int status) {
+    char path[PATH_MAX];
+    char cwd[PATH_MAX];
+    char header[96];
+    struct trace_buf buf = {NULL, 0, 0};
+    const char *output = "-";
+
+    int argc = 0;
+    while (exec->argv[argc]) {
+        argc++;
+    }
+    // The command line of a response file the wrapper wrote itself.
+    char **argv = exec->rsp_fd >= 0 ? expand_args(exec, exec->argv, &argc) : exec->argv;
+    for (int i = 1; i < argc; i++) {
+        if (strings_equal(argv[i], "-o") && i + 1 < argc) {
+            output = argv[i + 1];
+        }
+    }
+    if (!getcwd(cwd, sizeof(cwd)) || trace_dir(path, sizeof(path)) != 0) {
+        return;
+    }
+    size_t len = strlen(path);
+    if (snprintf(path + len, sizeof(path) - len, "/%d.log", (int)(getpid() % TRACE_SHARDS)) >= (int)(sizeof(path) - len) ||
+        make_parents(path) != 0) {
+        return;
+    }
+
+    snprintf(header, sizeof(header), "%lld %lld %d", start, end ? end - start : -1, status);
+    trace_append(exec, &buf, header, 0);
+    trace_append(exec, &buf, "\t", 0);
+    trace_append(exec, &buf, cwd, 1);
+    trace_append(exec, &buf, "\t", 0);
+    trace_append(exec, &buf, output, 1);
+    for (int i = 0; i < argc; i++) {
+        trace_append(exec, &buf, "\t", 0);
+        trace_append(exec, &buf, argv[i], 1);
+    }
+    trace_append(exec, &buf, "\n", 0);
+
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        ssize_t n = write(fd, buf.data, buf.len);
+        (void)n;
+        close(fd);
+    }
+}
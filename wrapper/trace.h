@@ -0,0 +1,29 @@
+#ifndef INTERCEPTOR_TRACE_H
+#define INTERCEPTOR_TRACE_H
+
+#include "rewrite.h"
+
+// Build trace: one record per compiler invocation, with its working
+// directory, output, final argv and timing.
+
+// Nonzero if INTERCEPTOR_TRACE asks for the trace.
+int trace_enabled(void);
+
+// Builds the trace directory into path. Returns 0, or -1 if it doesn't fit.
+int trace_dir(char *path, size_t size);
+
+// Wall clock time in nanoseconds.
+long long trace_now(void);
+
+// Appends the record of exec, which started at start and ended at end with
+// status. end is 0 and status -1 when the wrapper doesn't wait for the
+// compiler.
+void trace_record(struct interceptor_exec *exec, long long start, long long end, int status);
+
+// `interceptor trace-merge [output]`: writes compile_commands.json.
+int trace_merge(const char *output);
+
+// `interceptor trace-report [-n count]`: prints the slowest TUs.
+int trace_report(int count);
+
+#endif
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "trace.h"
+#include "util.h"
+
+// Reads the trace shards back. Only compiles of a source file count. When a
+// TU was compiled more than once, into the same output from the same
+// directory, its latest record wins.
+
+struct trace_entry {
+    long long start;
+    long long duration; // -1 if unknown
+    int status;
+    char *cwd;
+    char *output;
+    char **argv;
+    const char *file;
+};
+
+struct trace_entries {
+    struct trace_entry *entries;
+    int count;
+    int capacity;
+};
+
+// Splits line at tabs and unescapes the fields in place. Returns the number
+// of fields.
+int trace_split(char *line, char **fields, int max) {
+    int count = 0;
+    char *out = line;
+    fields[count++] = line;
+    for (char *p = line; *p && *p != '\n'; p++) {
+        if (*p == '\t') {
+            *out++ = '\0';
+            if (count == max) {
+                return -1;
+            }
+            fields[count++] = out;
+        } else if (*p == '\\' && p[1]) {
+            p++;
+            *out++ = *p == 't' ? '\t' : *p == 'n' ? '\n' : *p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+    return count;
+}
+
+void trace_parse(struct trace_entries *entries, char *line) {
+    struct trace_entry entry;
+    int fields_max = 16;
+    char **fields = NULL;
+    int count;
+
+    // Fields after the fourth are argv; grow until the line fits.
+    for (;;) {
+        fields = realloc(fields, (fields_max + 1) * sizeof(char *));
+        if (!fields) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        char *copy = strdup(line);
+        if (!copy) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        count = trace_split(copy, fields, fields_max);
+        if (count >= 0) {
+            break;
+        }
+        free(copy);
+        fields_max *= 2;
+    }
+    if (count < 4 || sscanf(fields[0], "%lld %lld %d", &entry.start, &entry.duration, &entry.status) != 3) {
+        free(fields[0]);
+        free(fields);
+        return;
+    }
+    fields[count] = NULL;
+    entry.cwd = fields[1];
+    entry.output = fields[2];
+    entry.argv = fields + 3;
+    entry.file = command_source(entry.argv);
+    if (!entry.file) {
+        free(fields[0]);
+        free(fields);
+        return;
+    }
+    if (entries->count == entries->capacity) {
+        entries->capacity = entries->capacity ? entries->capacity * 2 : 256;
+        entries->entries = realloc(entries->entries, entries->capacity * sizeof(entry));
+        if (!entries->entries) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    entries->entries[entries->count++] = entry;
+}
+
+int compare_entries(const void *a, const void *b) {
+    const struct trace_entry *x = a;
+    const struct trace_entry *y = b;
+    int res = strcmp(x->cwd, y->cwd);
+    if (!res) {
+        res = strcmp(x->file, y->file);
+    }
+    if (!res) {
+        res = strcmp(x->output, y->output);
+    }
+    if (!res) {
+        res = (x->start > y->start) - (x->start < y->start);
+    }
+    return res;
+}
+
+int compare_durations(const void *a, const void *b) {
+    const struct trace_entry *x = a;
+    const struct trace_entry *y = b;
+    return (x->duration < y->duration) - (x->duration > y->duration);
+}
+
+// Loads every shard and keeps the latest record per TU. Returns -1 if the
+// trace directory can't be read.
+int trace_load(struct trace_entries *entries) {
+    char dir_path[PATH_MAX];
+    char path[PATH_MAX];
+    char *line = NULL;
+    size_t size = 0;
+    struct dirent *ent;
+
+    entries->entries = NULL;
+    entries->count = 0;
+    entries->capacity = 0;
+    if (trace_dir(dir_path, sizeof(dir_path)) != 0) {
+        return -1;
+    }
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        perror(dir_path);
+        return -1;
+    }
+    while ((ent = readdir(dir))) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || !strings_equal(ent->d_name + len - 4, ".log")) {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+        FILE *file = fopen(path, "re");
+        if (!file) {
+            continue;
+        }
+        while (getline(&line, &size, file) > 0) {
+            trace_parse(entries, line);
+        }
+        fclose(file);
+    }
+    closedir(dir);
+    free(line);
+
+    qsort(entries->entries, entries->count, sizeof(struct trace_entry), compare_entries);
+    int count = 0;
+    for (int i = 0; i < entries->count; i++) {
+        struct trace_entry *entry = &entries->entries[i];
+        struct trace_entry *next = i + 1 < entries->count ? entry + 1 : NULL;
+        if (next && strings_equal(entry->cwd, next->cwd) && strings_equal(entry->file, next->file) &&
+            strings_equal(entry->output, next->output)) {
+            continue;
+        }
+        entries->entries[count++] = *entry;
+    }
+    entries->count = count;
+    return 0;
+}
+
+void json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char ch = *str;
+        if (ch == '"' || ch == '\\') {
+            fprintf(out, "\\%c", ch);
+        } else if (ch < 0x20) {
+            fprintf(out, "\\u%04x", ch);
+        } else {
+            fputc(ch, out);
+        }
+    }
+    fputc('"', out);
+}
+
+int trace_merge(const char *output) {
+    struct trace_entries entries;
+    char tmp[PATH_MAX];
+
+    if (trace_load(&entries) != 0) {
+        return 1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", output);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        perror(tmp);
+        return 1;
+    }
+    FILE *out = fdopen(fd, "w");
+    if (!out) {
+        perror(tmp);
+        unlink(tmp);
+        return 1;
+    }
+    fprintf(out, "[");
+    for (int i = 0; i < entries.count; i++) {
+        struct trace_entry *entry = &entries.entries[i];
+        fprintf(out, "%s\n  {\"directory\": ", i ? "," : "");
+        json_string(out, entry->cwd);
+        fprintf(out, ", \"file\": ");
+        json_string(out, entry->file);
+        if (!strings_equal(entry->output, "-")) {
+            fprintf(out, ", \"output\": ");
+            json_string(out, entry->output);
+        }
+        fprintf(out, ", \"arguments\": [");
+        for (int j = 0; entry->argv[j]; j++) {
+            fprintf(out, "%s", j ? ", " : "");
+            json_string(out, entry->argv[j]);
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n]\n");
+    if (fchmod(fd, 0644) != 0 || fclose(out) != 0 || rename(tmp, output) != 0) {
+        perror(output);
+        unlink(tmp);
+        return 1;
+    }
+    printf("%s: %d TUs\n", output, entries.count);
+    return 0;
+}
+
+int trace_report(int count) {
+    struct trace_entries entries;
+    long long total = 0;
+    int timed = 0;
+
+    if (trace_load(&entries) != 0) {
+        return 1;
+    }
+    // Records written by the preload library have no duration.
+    for (int i = 0; i < entries.count; i++) {
+        if (entries.entries[i].duration >= 0) {
+            entries.entries[timed++] = entries.entries[i];
+            total += entries.entries[i].duration;
+        }
+    }
+    qsort(entries.entries, timed, sizeof(struct trace_entry), compare_durations);
+    printf("tus %d timed %d total_ms %.1f\n", entries.count, timed, total / 1e6);
+    for (int i = 0; i < timed && i < count; i++) {
+        struct trace_entry *entry = &entries.entries[i];
+        printf("%10.1f ms  %s%s%s%s\n", entry->duration / 1e6,
+               entry->file[0] == '/' ? "" : entry->cwd, entry->file[0] == '/' ? "" : "/", entry->file,
+               entry->status ? "  (failed)" : "");
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util.h"
+
+int make_parents(const char *path) {
+    char dir[4096];
+    int len = snprintf(dir, sizeof(dir), "%s", path);
+    if (len < 0 || len >= (int)sizeof(dir)) {
+        return -1;
+    }
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+int state_file(char *path, size_t size, const char *name) {
+    const char *dir = getenv("INTERCEPTOR_STATE_DIR");
+    if (!dir || !*dir) {
+        dir = STATE_DIR;
+    }
+    int len = snprintf(path, size, "%s/%s", dir, name);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+int state_path(char *path, size_t size, const char *name) {
+    if (state_file(path, size, name) != 0) {
+        return -1;
+    }
+    return make_parents(path);
+}
+
+int counters_parse(FILE *file, const char *const names[], long long values[], int count) {
+    char name[64];
+    long long value;
+
+    for (int i = 0; i < count; i++) {
+        values[i] = 0;
+    }
+    while (fscanf(file, "%63s %lld", name, &value) == 2) {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(name, names[i]) == 0) {
+                values[i] = value;
+            }
+        }
+    }
+    return 0;
+}
+
+int counters_update(const char *path, const char *const names[], const long long deltas[], long long values[], int count) {
+    long long current[count];
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    FILE *file = fdopen(fd, "r+");
+    if (!file) {
+        close(fd);
+        return -1;
+    }
+    flock(fd, LOCK_EX);
+    counters_parse(file, names, current, count);
+    rewind(file);
+    for (int i = 0; i < count; i++) {
+        current[i] += deltas[i];
+        fprintf(file, "%s %lld\n", names[i], current[i]);
+        if (values) {
+            values[i] = current[i];
+        }
+    }
+    fflush(file);
+    if (ftruncate(fd, ftell(file)) != 0) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+int counters_read(const char *path, const char *const names[], long long values[], int count) {
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        for (int i = 0; i < count; i++) {
+            values[i] = 0;
+        }
+        return errno == ENOENT ? 0 : -1;
+    }
+    flock(fileno(file), LOCK_SH);
+    counters_parse(file, names, values, count);
+    fclose(file);
+    return 0;
+}
+
+long long parse_size(const char *str, long long def) {
+    char *end;
+    if (!str || !*str) {
+        return def;
+    }
+    long long size = strtoll(str, &end, 10);
+    switch (*end) {
+    case 'k':
+    case 'K':
+        size <<= 10;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        size <<= 20;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        size <<= 30;
+        end++;
+        break;
+    }
+    if (*end || size <= 0) {
+        return def;
+    }
+    return size;
+}
+
+int find_program(const char *name, char *path, size_t size) {
+    const char *search = getenv("PATH");
+    if (!search) {
+        search = "/bin:/usr/bin";
+    }
+    while (*search) {
+        int len = strcspn(search, ":");
+        snprintf(path, size, "%.*s%s%s", len, search, len ? "/" : "", name);
+        if (access(path, X_OK) == 0) {
+            return 0;
+        }
+        search += len;
+        if (*search) {
+            search++;
+        }
+    }
+    return -1;
+}
+
+int run_child(const char *pathname, char *const argv[], char *const envp[], int stdout_fd, int stderr_fd) {
+    int status;
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        if (stdout_fd >= 0) {
+            dup2(stdout_fd, STDOUT_FILENO);
+        }
+        if (stderr_fd >= 0) {
+            dup2(stderr_fd, STDERR_FILENO);
+        }
+        execve(pathname, argv, envp);
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+int process_start(int pid, char *state, unsigned long long *starttime) {
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    // comm may contain anything, so fields are counted from its closing ')'.
+    const char *p = strrchr(buf, ')');
+    if (!p || sscanf(p + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                     state, starttime) != 2) {
+        return -1;
+    }
+    return 0;
+}
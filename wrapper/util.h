@@ -0,0 +1,42 @@
+#ifndef INTERCEPTOR_UTIL_H
+#define INTERCEPTOR_UTIL_H
+
+#include <stddef.h>
+
+#define STATE_DIR "/var/cache/interceptor"
+
+// Builds $INTERCEPTOR_STATE_DIR/name (default STATE_DIR/name) into path.
+// Returns 0, or -1 if it doesn't fit.
+int state_file(char *path, size_t size, const char *name);
+
+// Like state_file(), and also creates the parent directories.
+int state_path(char *path, size_t size, const char *name);
+
+// Creates every missing directory in front of the last '/' of path.
+int make_parents(const char *path);
+
+// Reads "name value" counters from path under an exclusive lock, adds deltas
+// and writes them back. Missing counters start at 0. values (may be NULL)
+// receives the updated counts. Returns 0, or -1 on error.
+int counters_update(const char *path, const char *const names[], const long long deltas[], long long values[], int count);
+
+// Reads counters from path without changing them.
+int counters_read(const char *path, const char *const names[], long long values[], int count);
+
+// Parses a size such as 512M or 5G. Returns def on error.
+long long parse_size(const char *str, long long def);
+
+// Finds name in PATH. Returns 0 and fills path, or -1.
+int find_program(const char *name, char *path, size_t size);
+
+// Runs pathname with argv and envp and waits for it. stdout_fd and stderr_fd
+// replace the child's stdout and stderr unless they are -1. Returns the exit
+// status, 128 + signal number, or -1 if it couldn't be started.
+int run_child(const char *pathname, char *const argv[], char *const envp[], int stdout_fd, int stderr_fd);
+
+// Reads the state letter and start time (in clock ticks since boot) of pid
+// from /proc. Returns -1 if it is gone. The start time tells a reused pid
+// apart.
+int process_start(int pid, char *state, unsigned long long *starttime);
+
+#endif
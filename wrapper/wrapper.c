@@ -1,79 +1,100 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
-// #include "pex.h"
-
-#define MAX_NEW_ARGV 32
-#define ENV_SKIP_INTERCEPTION "SKIP_INTERCEPTION=1"
-#define LTO_PLUGIN_PATH "/usr/lib/bfd-plugins/liblto_plugin.so"
-
-char *const gcc_compiler_list[] = {"gcc", "g++", "c++", "cc", "xgcc", "xg++", NULL};
-char *const binutils_list[] = {"ar", "nm", "ranlib", NULL};
-char *const binutils_new_list[] = {"nm-new", NULL};
-
-int strings_equal(const char *str1, const char *str2) {
-    if (strcmp(str1, str2) == 0) {
-        return 1;
-    }
-    return 0;
+#include "admission.h"
+#include "cache.h"
+#include "debuginfo.h"
+#include "fallback.h"
+#include "pch.h"
+#include "pgo.h"
+#include "probe.h"
+#include "profile.h"
+#include "rewrite.h"
+#include "scratch.h"
+#include "trace.h"
+#include "util.h"
+
+int usage(void) {
+    fprintf(stderr, "usage: interceptor admit-status\n"
+                    "       interceptor cache-stats\n"
+                    "       interceptor pch-stats\n"
+                    "       interceptor probe-stats\n"
+                    "       interceptor profile-compile <config> [output]\n"
+                    "       interceptor fallback-set <full|safe|minimal|original> <source>...\n"
+                    "       interceptor fallback-list\n"
+                    "       interceptor pgo-phase <off|generate|use>\n"
+                    "       interceptor pgo-merge <pgo dir>...\n"
+                    "       interceptor pgo-status [-v]\n"
+                    "       interceptor scratch-status\n"
+                    "       interceptor trace-merge [output]\n"
+                    "       interceptor trace-report [-n count]\n");
+    return 1;
 }
 
-int strings_equal_n(const char *str1, const char *str2) {
-    if (strncmp(str1, str2, strlen(str2)) == 0) {
-        return 1;
+// Run directly as `interceptor <command>`, not through the module.
+int command_main(int argc, char *argv[]) {
+    if (argc < 2) {
+        return usage();
     }
-    return 0;
-}
-
-int match_list(const char *str, char *const list[]) {
-    for (int i = 0; list[i]; i++) {
-        if (strings_equal(str, list[i])) {
-            return i + 1;
-        }
+    if (strings_equal(argv[1], "admit-status")) {
+        return admission_print_status();
     }
-    return 0;
-}
-
-char *insert_wrapper(const char *str1, const char *str2, int index) {
-    int str1_len = strlen(str1);
-    int new_len = str1_len + strlen(str2) + 1;
-    int insert_pos = str1_len - strlen(binutils_list[index - 1]);
-    char *res = (char *)malloc(new_len);
-    if (!res) {
-        perror("Memory allocation failed");
-        exit(EXIT_FAILURE);
-    }
-    memset(res, '\0', new_len);
-    strncpy(res, str1, insert_pos);
-    strcat(res, str2);
-    strcat(res, str1 + insert_pos);
-
-    return res;
-}
-
-char *get_basename(const char *path, const char delimiter) {
-    char *last_char = strrchr(path, delimiter);
-    if (last_char) {
-        return last_char + 1;
+    if (strings_equal(argv[1], "cache-stats")) {
+        return cache_print_stats();
+    }
+    if (strings_equal(argv[1], "pch-stats")) {
+        return pch_print_stats();
     }
-    return (char *)path;
+    if (strings_equal(argv[1], "probe-stats")) {
+        return probe_print_stats();
+    }
+    if (strings_equal(argv[1], "profile-compile") && (argc == 3 || argc == 4)) {
+        return profile_compile(argv[2], argc == 4 ? argv[3] : PROFILE_TABLE_PATH);
+    }
+    if (strings_equal(argv[1], "fallback-set") && argc >= 4) {
+        return fallback_set(argv[2], argv + 3, argc - 3);
+    }
+    if (strings_equal(argv[1], "fallback-list")) {
+        return fallback_list();
+    }
+    if (strings_equal(argv[1], "pgo-phase") && argc == 3) {
+        return pgo_set_phase(argv[2]);
+    }
+    if (strings_equal(argv[1], "pgo-merge") && argc >= 3) {
+        return pgo_merge(argv + 2, argc - 2);
+    }
+    if (strings_equal(argv[1], "pgo-status") && (argc == 2 || (argc == 3 && strings_equal(argv[2], "-v")))) {
+        return pgo_print_status(argc == 3);
+    }
+    if (strings_equal(argv[1], "scratch-status")) {
+        return scratch_print_status();
+    }
+    if (strings_equal(argv[1], "trace-merge") && argc <= 3) {
+        return trace_merge(argc == 3 ? argv[2] : "compile_commands.json");
+    }
+    if (strings_equal(argv[1], "trace-report") && (argc == 2 || (argc == 4 && strings_equal(argv[2], "-n")))) {
+        return trace_report(argc == 4 ? atoi(argv[3]) : 20);
+    }
+    return usage();
 }
 
-int file_exists(const char *path) {
-    int res = 0;
-    if (access(path, R_OK) == 0) {
-        res |= 4;
+// Runs the compile through the fallback, cache and split DWARF paths. Returns
+// its exit status, or -1 if none of them took it.
+int run_compiler(struct interceptor_exec *exec, char *envp[]) {
+    if (fallback_enabled()) {
+        int status = fallback_exec(exec, envp);
+        if (status >= 0) {
+            return status;
+        }
     }
-    // if (access(path, W_OK) == 0) {
-    //     res |= 2;
-    // }
-    if (access(path, X_OK) == 0) {
-        res |= 1;
+    if (cache_enabled()) {
+        int status = cache_exec(exec, envp);
+        if (status >= 0) {
+            return status;
+        }
     }
-    return res;
+    return debuginfo_exec(exec, envp);
 }
 
 int main(int argc, char *argv[], char *envp[]) {
@@ -84,163 +105,56 @@ int main(int argc, char *argv[], char *envp[]) {
     //     printf("%s\n", envp[i]);
     // }
 
-    int envc;
+    if (strings_equal(get_basename(argv[0], '/'), "interceptor")) {
+        return command_main(argc, argv);
+    }
+
+    struct interceptor_exec exec;
     char *pathname = argv[0];
     argv++;
-    argc--;
 
-    char *new_pathname = NULL;
-    int new_argc = 0;
-    char **new_argv = NULL;
-    int new_envc = 0;
-    char **new_envp = NULL;
+    exec.arena = NULL;
 
-    for (envc = 0; envp[envc]; envc++) {
-        if (strings_equal(envp[envc], ENV_SKIP_INTERCEPTION)) {
-            goto skip_interception;
+    interceptor_rewrite(pathname, argv, &exec);
+    // configure probes run unchanged, but identical ones can be replayed.
+    if (!exec.compiler && probe_cache_enabled()) {
+        int status = probe_exec(pathname, argv, envp);
+        if (status >= 0) {
+            return status;
         }
     }
-
-    const char *basename_slash = get_basename(pathname, '/');
-    const char *basename_dash = get_basename(basename_slash, '-');
-
-    int gcc_compiler = match_list(basename_dash, gcc_compiler_list);
-    int binutils = match_list(basename_dash, binutils_list);
-    int binutils_new = match_list(basename_slash, binutils_new_list);
-
-    if (binutils || binutils_new) {
-        int lto_plugin_available = 0;
-        for (int i = 0; i < argc && argv[i]; i++) {
-            if (!strings_equal(argv[i], "--plugin")) {
-                continue;
-            }
-            if (!argv[i + 1]) {
-                continue;
-            }
-            i++;
-            if (!file_exists(argv[i])) {
-                continue;
-            }
-            if (strings_equal_n(get_basename(argv[i], '/'), "liblto_plugin.so")) {
-                lto_plugin_available = 1;
-            }
-        }
-        if (!lto_plugin_available) {
-            new_argv = malloc((argc + 3) * sizeof(char *));
-            for (int i = 0; i < argc && argv[i]; i++) {
-                new_argv[new_argc++] = argv[i];
-            }
-            int dirname_len = strrchr(pathname, '/') - pathname;
-            char *new_lto_plugin_path = malloc(dirname_len + strlen("/liblto_plugin.so") + 1);
-            strncpy(new_lto_plugin_path, pathname, dirname_len);
-            strcat(new_lto_plugin_path, "/liblto_plugin.so");
-            if (file_exists(new_lto_plugin_path)) {
-                lto_plugin_available = 1;
-                new_argv[new_argc++] = "--plugin";
-                new_argv[new_argc++] = new_lto_plugin_path;
-            } else {
-                free(new_lto_plugin_path);
-            }
-            if (!lto_plugin_available) {
-                char *wrapper_pathname = insert_wrapper(pathname, "gcc-", binutils);
-                if (!binutils_new && (file_exists(wrapper_pathname) & 1)) { // Check if gcc wrapper is available
-                    lto_plugin_available = 1;
-                    new_pathname = wrapper_pathname;
-                    // If gcc wrapper is available, also modify argv[0]
-                    // new_argv[0] = insert_wrapper(argv[0], "gcc-", binutils);
-                } else {
-                    free(wrapper_pathname);
-                }
-            }
-            if (!lto_plugin_available) {
-                new_argv[new_argc++] = "--plugin";
-                new_argv[new_argc++] = LTO_PLUGIN_PATH;
-            }
-            new_argv[new_argc] = NULL;
-        }
-    } else if (gcc_compiler) {
-        new_argv = malloc((argc + MAX_NEW_ARGV) * sizeof(char *));
-
-        new_argv[new_argc++] = argv[0];
-        new_argv[new_argc++] = "-march=native";
-        new_argv[new_argc++] = "-mtune=native";
-
-        for (int i = 1; i < argc && argv[i]; i++) {
-            if (strings_equal(argv[i], "-v") ||
-                strings_equal(argv[i], "-V") ||
-                strings_equal(argv[i], "--version") ||
-                strings_equal(argv[i], "-qversion") ||
-                strings_equal_n(get_basename(argv[i], '/'), "conftest")) {
-                new_argc = 0;
-                free(new_argv);
-                goto skip_interception;
-            }
-            // Remove -O*, -march and -mtune
-            if ((strings_equal_n(argv[i], "-O") && !strings_equal(argv[i], "-Ofast")) ||
-                strings_equal_n(argv[i], "-march=") ||
-                strings_equal_n(argv[i], "-mtune=")) {
-                continue;
-            }
-            new_argv[new_argc++] = argv[i];
-        }
-
-        // Add new arguments
-        new_argv[new_argc++] = "-pipe";
-        new_argv[new_argc++] = "-Wno-error";
-        new_argv[new_argc++] = "-O3";
-        if (file_exists("/usr/bin/interceptor_use_lto")) {
-            new_argv[new_argc++] = "-flto";
-            new_argv[new_argc++] = "-fno-fat-lto-objects";
-            new_argv[new_argc++] = "-flto-partition=none";
-            new_argv[new_argc++] = "-flto-compression-level=0";
-            new_argv[new_argc++] = "-fuse-linker-plugin";
-        }
-        if (gcc_compiler < 5) {
-            new_argv[new_argc++] = "-fuse-ld=gold";
-        }
-        new_argv[new_argc++] = "-fgraphite-identity";
-        new_argv[new_argc++] = "-floop-nest-optimize";
-        new_argv[new_argc++] = "-fipa-pta";
-        new_argv[new_argc++] = "-fno-semantic-interposition";
-        new_argv[new_argc++] = "-fno-common";
-        new_argv[new_argc++] = "-fdevirtualize-at-ltrans";
-        new_argv[new_argc++] = "-fno-plt";
-        new_argv[new_argc++] = "-ffunction-sections";
-        new_argv[new_argc++] = "-fdata-sections";
-        new_argv[new_argc++] = "-mtls-dialect=gnu2";
-        new_argv[new_argc++] = "-malign-data=cacheline";
-        new_argv[new_argc++] = "-Wl,-O2";
-        new_argv[new_argc++] = "-Wl,--gc-sections";
-
-        new_argv[new_argc] = NULL;
+    if (exec.compiler && admission_enabled()) {
+        admission_enter(admission_estimate(&exec));
     }
-
-    new_envp = malloc((envc + 2) * sizeof(char *));
-    new_envp[0] = ENV_SKIP_INTERCEPTION;
-    memcpy(new_envp + 1, envp, envc * sizeof(char *));
-    new_envc = envc + 1;
-    new_envp[new_envc] = NULL;
-
-skip_interception:
-    if (!new_pathname) {
-        new_pathname = pathname;
+    if (exec.compiler && scratch_enabled()) {
+        envp = scratch_enter(&exec, envp);
     }
-    if (!new_argc) {
-        new_argv = argv;
+    // Traces leave out the PCH, whose header only exists in the state directory.
+    char **traced_argv = exec.argv;
+    if (exec.compiler && pch_enabled()) {
+        pch_apply(&exec, envp);
     }
-    if (!new_envc) {
-        new_envp = envp;
+    if (exec.compiler && trace_enabled()) {
+        // The wrapper has to outlive the compiler to time it.
+        long long start = trace_now();
+        int status = run_compiler(&exec, envp);
+        if (status < 0) {
+            status = run_child(exec.pathname, exec.argv, envp, -1, -1);
+        }
+        exec.argv = traced_argv;
+        trace_record(&exec, start, trace_now(), status);
+        return status < 0 ? 1 : status;
     }
-
-    return execve(new_pathname, new_argv, new_envp);
-
-    // if (new_pathname != pathname) {
-    //     free(new_pathname);
-    // }
-    // if (new_argc) {
-    //     free(new_argv);
-    // }
-    // if (new_envc) {
-    //     free(new_envp);
-    // }
+    if (exec.compiler) {
+        int status = run_compiler(&exec, envp);
+        if (status >= 0) {
+            return status;
+        }
+    }
+    execve(exec.pathname, exec.argv, envp);
+    // A cached gcc-<tool> resolution may be stale; run the tool itself.
+    if (exec.pathname != pathname) {
+        execve(pathname, argv, envp);
+    }
+    return -1;
 }